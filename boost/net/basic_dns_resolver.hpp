@@ -37,6 +37,115 @@ namespace boost
             this->service.add_nameserver(this->implementation, addr);
           }
 
+          /*!
+           Number of sockets, each on its own source port, that queries are spread over.
+           Only has an effect before the first query.
+           */
+          void
+          sockets ( const std::size_t count )
+          {
+            this->service.sockets(this->implementation, count);
+          }
+
+          /*!
+           Sends over UDP sockets connected to the nameservers, so the kernel drops
+           datagrams from anyone else. Off by default.
+           */
+          void
+          connected ( const bool enable )
+          {
+            this->service.connected(this->implementation, enable);
+          }
+
+          /*!
+           How long a TCP connection to a nameserver stays open without queries, 5
+           seconds by default. Truncated answers are asked again over TCP. The timer that
+           closes the connection keeps the io_service busy until then.
+           */
+          void
+          tcp_idle ( const posix_time::time_duration& idle )
+          {
+            this->service.tcp_idle(this->implementation, idle);
+          }
+
+          /*!
+           UDP payload size advertised with EDNS0 on every query, 1232 bytes by default.
+           0 sends queries without EDNS0, whose answers stop at 512 bytes.
+           */
+          void
+          edns_payload ( const uint16_t payload )
+          {
+            this->service.edns_payload(this->implementation, payload);
+          }
+
+          void
+          stale_deadline ( const posix_time::time_duration& deadline )
+          {
+            this->service.stale_deadline(this->implementation, deadline);
+          }
+
+          /*!
+           Gives the resolver a cache of its own instead of the process wide one. The
+           cache has to outlive the resolver.
+           */
+          template<typename Cache>
+            void
+            cache ( Cache& c )
+            {
+              this->service.cache(this->implementation, c);
+            }
+
+          /*!
+           Sends every query to every nameserver instead of the one with the best
+           round trip time and error rate.
+           */
+          void
+          broadcast ( const bool enable )
+          {
+            this->service.broadcast(this->implementation, enable);
+          }
+
+          /*!
+           Share of the queries that go to a nameserver other than the best one
+           */
+          void
+          explore ( const double fraction )
+          {
+            this->service.explore(this->implementation, fraction);
+          }
+
+          /*!
+           Sends a second copy of a slow query to the next best nameserver, after the
+           95th percentile round trip of the first one or floor. At most budget copies
+           per query.
+           */
+          void
+          hedge ( const posix_time::time_duration& floor, const double budget )
+          {
+            this->service.hedge(this->implementation, floor, budget);
+          }
+
+          /*!
+           Bounds of the retransmission timeout, 50 ms and 5 seconds by default. The
+           timeout follows the round trips of each nameserver and is at least min. It
+           doubles with every timeout of the nameserver until it answers again, up to max.
+           */
+          void
+          timeouts ( const posix_time::time_duration& min, const posix_time::time_duration& max )
+          {
+            this->service.timeouts(this->implementation, min, max);
+          }
+
+          /*!
+           Deadline and retransmissions of a query when async_resolve isn't given them,
+           30 seconds and 5 by default.
+           */
+          void
+          query_limits ( const posix_time::time_duration& deadline, const unsigned retries )
+          {
+            this->service.query_limits(this->implementation, deadline, retries);
+          }
+
           template<typename CallbackHandler>
             void
             async_resolve ( const net::dns::question & question, CallbackHandler handler )
@@ -44,6 +153,21 @@ namespace boost
               this->service.async_resolve(this->implementation, question, handler);
             }
 
+          /*!
+           Resolves a question, failing with timed_out after deadline or once the query
+           went unanswered retries more times, whichever comes first.
+           */
+          template<typename CallbackHandler>
+            void
+            async_resolve (
+                const net::dns::question & question,
+                const posix_time::time_duration& deadline,
+                const unsigned retries,
+                CallbackHandler handler )
+            {
+              this->service.async_resolve(this->implementation, question, deadline, retries, handler);
+            }
+
           template<typename CallbackHandler>
             void
             async_resolve ( const string & domain, const net::dns::type_t rrtype, CallbackHandler handler )
@@ -66,6 +190,10 @@ namespace boost
 
 #if !defined(GENERATING_DOCUMENTATION)
       typedef basic_dns_resolver< basic_dns_resolver_service< > > dns_resolver;
+
+      /// Resolver without a cache, every question goes upstream
+      typedef basic_dns_resolver< basic_dns_resolver_service< basic_dns_resolver_impl< dns_null_cache > > >
+          uncached_dns_resolver;
 #endif
 
     } // namespace dns
@@ -80,6 +80,18 @@ namespace boost
               impl->async_resolve(question, handler);
             }
 
+          template<typename CallbackHandler>
+            void
+            async_resolve (
+                implementation_type &impl,
+                const net::dns::question & question,
+                const posix_time::time_duration& deadline,
+                const unsigned retries,
+                CallbackHandler handler )
+            {
+              impl->async_resolve(question, deadline, retries, handler);
+            }
+
           template<typename CallbackHandler>
             void
             async_resolve (
@@ -98,6 +110,72 @@ namespace boost
             impl->add_nameserver(addr);
           }
 
+          void
+          sockets ( implementation_type &impl, const std::size_t count )
+          {
+            impl->sockets(count);
+          }
+
+          void
+          connected ( implementation_type &impl, const bool enable )
+          {
+            impl->connected(enable);
+          }
+
+          void
+          tcp_idle ( implementation_type &impl, const posix_time::time_duration& idle )
+          {
+            impl->tcp_idle(idle);
+          }
+
+          void
+          edns_payload ( implementation_type &impl, const uint16_t payload )
+          {
+            impl->edns_payload(payload);
+          }
+
+          void
+          stale_deadline ( implementation_type &impl, const posix_time::time_duration& deadline )
+          {
+            impl->stale_deadline(deadline);
+          }
+
+          void
+          cache ( implementation_type &impl, typename DnsResolverImplementation::cache_type& c )
+          {
+            impl->cache(c);
+          }
+
+          void
+          broadcast ( implementation_type &impl, const bool enable )
+          {
+            impl->broadcast(enable);
+          }
+
+          void
+          explore ( implementation_type &impl, const double fraction )
+          {
+            impl->explore(fraction);
+          }
+
+          void
+          hedge ( implementation_type &impl, const posix_time::time_duration& floor, const double budget )
+          {
+            impl->hedge(floor, budget);
+          }
+
+          void
+          timeouts ( implementation_type &impl, const posix_time::time_duration& min, const posix_time::time_duration& max )
+          {
+            impl->timeouts(min, max);
+          }
+
+          void
+          query_limits ( implementation_type &impl, const posix_time::time_duration& deadline, const unsigned retries )
+          {
+            impl->query_limits(deadline, retries);
+          }
+
         private:
           void
           shutdown_service ()
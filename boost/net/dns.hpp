@@ -77,6 +77,7 @@ namespace boost
         type_txt = 0x10, //!< Text type
         type_a6 = 0x1c, //!< Address (IP6) type
         type_srv = 0x21, //!< Service type
+        type_opt = 0x29, //!< EDNS0 option pseudo type
         type_axfr = 0xfc, //!< Zone transfer type
         type_all = 0xff
       //!< Query all types
@@ -2167,6 +2168,245 @@ namespace boost
 
       };
 
+      /*!
+       EDNS0 OPT pseudo resource record, RFC 6891
+
+       Rides in the additional section with the root as its owner name. The class field
+       holds the UDP payload size the sender can take, the TTL field the upper 8 bits of
+       the extended RCODE, the EDNS version and the DO bit, and the data a list of options.
+       */
+      class opt_resource : public resource_base_t
+      {
+      public:
+        /// An EDNS option, its code and opaque data
+        typedef std::pair< uint16_t, string > option_t;
+        /// A list of EDNS options
+        typedef std::vector< option_t > options_t;
+
+      protected:
+        /// Options carried in the record data
+        options_t rr_options;
+
+      public:
+        /// Default contructor, advertises the classic 512 bytes
+        opt_resource () :
+          resource_base_t(".", type_opt), rr_options()
+        {
+          rr_class = 512;
+        }
+
+        /// Constructs an opt_resource
+        /*
+         \param payload UDP payload size the sender can receive
+         */
+        explicit
+        opt_resource ( const uint16_t payload ) :
+          resource_base_t(".", type_opt), rr_options()
+        {
+          rr_class = payload;
+        }
+
+        /// Virtual Destructor
+        virtual
+        ~opt_resource ()
+        {
+        }
+
+        /*!
+         Sets the UDP payload size the sender can receive
+
+         \param s Payload size in bytes
+         \return Payload size
+         */
+        uint16_t
+        payload_size ( const uint16_t s )
+        {
+          rr_class = s;
+          return rr_class;
+        }
+
+        /*!
+         Gets the UDP payload size the sender can receive. Anything below 512 counts as 512.
+
+         \return Payload size
+         */
+        uint16_t
+        payload_size () const
+        {
+          return ( rr_class < 512 ) ? 512 : rr_class;
+        }
+
+        /*!
+         Sets the upper 8 bits of the extended RCODE
+
+         \param r Upper bits of the RCODE
+         \return Upper bits of the RCODE
+         */
+        uint8_t
+        extended_rcode ( const uint8_t r )
+        {
+          ttl(( ttl() & 0x00FFFFFF ) | ( uint32_t(r) << 24 ));
+          return r;
+        }
+
+        /*!
+         Gets the upper 8 bits of the extended RCODE
+
+         \return Upper bits of the RCODE
+         */
+        uint8_t
+        extended_rcode () const
+        {
+          return uint8_t(ttl() >> 24);
+        }
+
+        /*!
+         Sets the EDNS version
+
+         \param v Version, 0 is the only one defined
+         \return Version
+         */
+        uint8_t
+        version ( const uint8_t v )
+        {
+          ttl(( ttl() & 0xFF00FFFF ) | ( uint32_t(v) << 16 ));
+          return v;
+        }
+
+        /*!
+         Gets the EDNS version
+
+         \return Version
+         */
+        uint8_t
+        version () const
+        {
+          return uint8_t(ttl() >> 16);
+        }
+
+        /*!
+         Sets the 'DNSSEC OK' bit, asking for the DNSSEC records of an answer
+
+         \param d True if the sender understands DNSSEC records
+         */
+        void
+        dnssec_ok ( const bool d )
+        {
+          ttl(( d ) ? ( ttl() | 0x00008000 ) : ( ttl() & ~0x00008000 ));
+        }
+
+        /*!
+         Gets the 'DNSSEC OK' bit
+
+         \return True if the sender understands DNSSEC records
+         */
+        bool
+        is_dnssec_ok () const
+        {
+          return ( ttl() & 0x00008000 ) != 0;
+        }
+
+        /// Returns the options container
+        options_t*
+        options ()
+        {
+          return &rr_options;
+        }
+
+        /*!
+         Clones an existing resource record object
+         */
+        virtual shared_resource_base_t
+        clone () const
+        {
+          return shared_resource_base_t(new opt_resource(*this));
+        }
+
+        /// Friend to tie to the containers in the message class.
+        friend class message;
+
+      protected:
+        /// Copy Constructor
+        /*
+         \param o opt_resource to copy from
+         */
+        opt_resource ( const opt_resource& o ) :
+          resource_base_t(o), rr_options(o.rr_options)
+        {
+          ;
+        }
+
+        /// Copy Constructor
+        /*
+         \param o resource_base_t to copy from
+         */
+        opt_resource ( const resource_base_t& o ) :
+          resource_base_t(o), rr_options()
+        {
+          // the owner is always the root, which decodes as an empty name
+          rr_domain = ".";
+        }
+
+        /// Encodes the opt resource into a memory buffer
+        /*
+         \param buffer Buffer to encode the request into
+         \param offset_map DNS label compression map for label/offset values
+         */
+        virtual void
+        encode ( dns_buffer_t& buffer, rfc1035_414_t& offset_map )
+        {
+          resource_base_t::encode(buffer, offset_map);
+
+          size_t lenOffset(buffer.position() - sizeof(uint16_t));
+          size_t len(0);
+
+          options_t::const_iterator iter;
+          for( iter = rr_options.begin(); iter != rr_options.end(); ++iter )
+          {
+            len += buffer.put(iter->first);
+            len += buffer.put((uint16_t) iter->second.length());
+            len += buffer.put(iter->second, iter->second.length());
+          }
+
+          // lastly, update the length field
+          buffer.put((uint16_t) len, lenOffset, false);
+        }
+
+        /// Decodes the opt resource into a memory buffer
+        /*
+         \param buffer Buffer to decode the request into
+         */
+        virtual void
+        decode ( dns_buffer_t& buffer, rfc1035_414_t& )
+        {
+          rr_options.clear();
+
+          size_t end(buffer.position() + length());
+          while( buffer.position() + 2 * sizeof(uint16_t) <= end )
+          {
+            uint16_t code, len;
+            buffer.get(code);
+            buffer.get(len);
+
+            // an option running past the record is malformed, drop the rest of it
+            if( buffer.position() + len > end )
+              break;
+
+            // option data is binary, so byte by byte rather than as a C string
+            string data(len, '\0');
+            for( uint16_t i = 0; i < len; ++i )
+            {
+              uint8_t c;
+              buffer.get(c);
+              data[i] = char(c);
+            }
+            rr_options.push_back(option_t(code, data));
+          }
+
+          buffer.position(end);
+        }
+      };
+
       /// DNS Request/Response Message
       /**
        */
@@ -2270,11 +2510,13 @@ namespace boost
         rr_list_t authority_section;
         /// Additional records list
         rr_list_t additional_section;
+        /// EDNS0 OPT record, kept out of the additional records, empty without EDNS
+        shared_ptr< opt_resource > opt_record;
 
       public:
         /// Default constructor
         message () :
-          header(), question_section(), answer_section(), authority_section(), additional_section()
+          header(), question_section(), answer_section(), authority_section(), additional_section(), opt_record()
         {
           memset(&header, 0x00, sizeof ( header ));
         }
@@ -2285,7 +2527,7 @@ namespace boost
          \param q question to ask
          */
         message ( const dns::question& q ) :
-          header(), question_section(), answer_section(), authority_section(), additional_section()
+          header(), question_section(), answer_section(), authority_section(), additional_section(), opt_record()
         {
           memset(&header, 0x00, sizeof ( header ));
           question_section.push_back(q);
@@ -2302,7 +2544,7 @@ namespace boost
          \param t Resource type to query
          */
         message ( const string & d, const type_t t ) :
-          header(), question_section(), answer_section(), authority_section(), additional_section()
+          header(), question_section(), answer_section(), authority_section(), additional_section(), opt_record()
         {
           question_section.push_back(dns::question(d, t));
 
@@ -2317,7 +2559,7 @@ namespace boost
          \param p message to copy from
          */
         message ( const message& p ) :
-          header(), question_section(), answer_section(), authority_section(), additional_section()
+          header(), question_section(), answer_section(), authority_section(), additional_section(), opt_record()
         {
           operator=(p);
         }
@@ -2351,6 +2593,10 @@ namespace boost
           for( rIter = p.additional_section.begin(); rIter != p.additional_section.end(); ++rIter )
             additional_section.push_back( ( *rIter ));
 
+          opt_record.reset();
+          if( p.opt_record )
+            opt_record = static_pointer_cast< opt_resource > (p.opt_record->clone());
+
           return *this;
         }
 
@@ -2565,65 +2811,127 @@ namespace boost
         result_t
         result ( const result_t r )
         {
-          switch( r )
-          {
-          case noerror:
-            header.bit_fields &= static_cast< uint16_t > (~0x0007);
-            break;
+          header.bit_fields &= static_cast< uint16_t > (~0x000F);
+          header.bit_fields |= static_cast< uint16_t > (r & 0x000F);
 
-          default:
-            header.bit_fields |= static_cast< uint16_t > (r);
-            break;
-          }
+          return result();
+        }
 
-          if( header.bit_fields & 0x01 )
-            return format_error;
+        /*!
+         Gets the result code for the message.
 
-          if( header.bit_fields & 0x02 )
-            return server_error;
+         \return Result code
+         */
+        result_t
+        result () const
+        {
+          // RCODE is the low nibble of the header flags
+          return (result_t) ( header.bit_fields & 0x000F );
+        }
 
-          if( header.bit_fields & 0x03 )
-            return name_error;
+        /*!
+         Sets the 12 bit extended result code, the low 4 bits in the header and the rest
+         in the OPT record. Codes above 15 turn EDNS0 on.
 
-          if( header.bit_fields & 0x04 )
-            return not_implemented;
+         \param r Extended result code to assign to the message
+         \return Extended result code
+         */
+        uint16_t
+        extended_result ( const uint16_t r )
+        {
+          result((result_t) ( r & 0x000F ));
+          if( r > 0x000F && !opt_record )
+            edns(512);
+          if( opt_record )
+            opt_record->extended_rcode(uint8_t(r >> 4));
 
-          if( header.bit_fields & 0x05 )
-            return refused;
+          return extended_result();
+        }
 
-          if( header.bit_fields & 0x06 )
-            return no_result;
+        /*!
+         Gets the 12 bit extended result code, the same as result() without EDNS0
 
-          return noerror;
+         \return Extended result code
+         */
+        uint16_t
+        extended_result () const
+        {
+          uint16_t r(header.bit_fields & 0x000F);
+          if( opt_record )
+            r |= uint16_t(opt_record->extended_rcode()) << 4;
+
+          return r;
         }
 
         /*!
-         Gets the result code for the message.
+         Turns EDNS0 on or off. With it on, the message carries an OPT record that
+         advertises the UDP payload size the sender can receive.
 
-         \return Result code
+         \param payload UDP payload size in bytes, 0 to turn EDNS0 off
          */
-        result_t
-        result () const
+        void
+        edns ( const uint16_t payload )
         {
-          if( header.bit_fields & 0x01 )
-            return format_error;
+          if( !payload )
+            opt_record.reset();
+          else if( opt_record )
+            opt_record->payload_size(payload);
+          else
+            opt_record.reset(new opt_resource(payload));
+        }
 
-          if( header.bit_fields & 0x02 )
-            return server_error;
+        /*!
+         Gets whether the message carries an OPT record
 
-          if( header.bit_fields & 0x03 )
-            return name_error;
+         \return True with EDNS0
+         */
+        bool
+        is_edns () const
+        {
+          return opt_record.get() != 0;
+        }
 
-          if( header.bit_fields & 0x04 )
-            return not_implemented;
+        /*!
+         Gets the UDP payload size the sender of the message can receive
 
-          if( header.bit_fields & 0x05 )
-            return refused;
+         \return Payload size in bytes, 512 without EDNS0
+         */
+        uint16_t
+        payload_size () const
+        {
+          return opt_record ? opt_record->payload_size() : 512;
+        }
+
+        /*!
+         Sets the 'DNSSEC OK' bit. Setting it turns EDNS0 on.
+
+         \param d True if the sender understands DNSSEC records
+         */
+        void
+        dnssec_ok ( const bool d )
+        {
+          if( d && !opt_record )
+            edns(512);
+          if( opt_record )
+            opt_record->dnssec_ok(d);
+        }
 
-          if( header.bit_fields & 0x06 )
-            return no_result;
+        /*!
+         Gets the 'DNSSEC OK' bit
+
+         \return True if the sender understands DNSSEC records
+         */
+        bool
+        is_dnssec_ok () const
+        {
+          return opt_record && opt_record->is_dnssec_ok();
+        }
 
-          return noerror;
+        /// Returns the OPT record, empty without EDNS0
+        shared_ptr< opt_resource >
+        opt ()
+        {
+          return opt_record;
         }
 
         /// Returns the questions container
@@ -2660,6 +2968,7 @@ namespace boost
         {
           // reset the buffer to the 0th position and reset the length
           buffer.position(0);
+          buffer.length(0);
 
           rfc1035_414_t offset_map;
 
@@ -2668,7 +2977,7 @@ namespace boost
           buffer.put((uint16_t) question_section.size());
           buffer.put((uint16_t) answer_section.size());
           buffer.put((uint16_t) authority_section.size());
-          buffer.put((uint16_t) additional_section.size());
+          buffer.put((uint16_t) ( additional_section.size() + ( opt_record ? 1 : 0 ) ));
 
           questions_t::iterator qiter;
           for( qiter = question_section.begin(); qiter != question_section.end(); ++qiter )
@@ -2681,6 +2990,8 @@ namespace boost
             ( *riter )->encode(buffer, offset_map);
           for( riter = additional_section.begin(); riter != additional_section.end(); ++riter )
             ( *riter )->encode(buffer, offset_map);
+          if( opt_record )
+            opt_record->encode(buffer, offset_map);
         }
 
         /// Decodes the dns message into a memory buffer
@@ -2695,6 +3006,7 @@ namespace boost
           answer_section.erase(answer_section.begin(), answer_section.end());
           authority_section.erase(authority_section.begin(), authority_section.end());
           additional_section.erase(additional_section.begin(), additional_section.end());
+          opt_record.reset();
 
           // start at 0th
           buffer.position(0);
@@ -2709,8 +3021,12 @@ namespace boost
           rfc1035_414_t offset_map;
 
           // read the sections
+          // decoded in place, a copy would copy the name
           for( uint16_t i = 0; i < header.QdCount; ++i )
-            question_section.push_back(question(buffer, offset_map));
+          {
+            question_section.push_back(question());
+            question_section.back().decode(buffer, offset_map);
+          }
 
           for( uint16_t i = 0; i < header.AnCount; ++i )
             answer_section.push_back(unpack_record(buffer, offset_map));
@@ -2719,7 +3035,14 @@ namespace boost
             authority_section.push_back(unpack_record(buffer, offset_map));
 
           for( uint16_t i = 0; i < header.ArCount; ++i )
-            additional_section.push_back(unpack_record(buffer, offset_map));
+          {
+            // the OPT record describes the message, it isn't data
+            shared_resource_base_t rr(unpack_record(buffer, offset_map));
+            if( rr->rtype() == type_opt )
+              opt_record = static_pointer_cast< opt_resource > (rr);
+            else
+              additional_section.push_back(rr);
+          }
         }
 
       private:
@@ -2735,6 +3058,10 @@ namespace boost
           resource_base_t preamble;
           preamble.decode(buffer, offset_map);
 
+          // the record takes the owner name over, copying the preamble copies an empty name
+          string owner;
+          owner.swap(preamble.rr_domain);
+
           switch( preamble.rtype() )
           {
           case type_a:
@@ -2807,6 +3134,13 @@ namespace boost
             ptr = shared_resource_base_t(srvPtr);
           }
             break;
+          case type_opt:
+          {
+            dns::opt_resource* optPtr = new dns::opt_resource(preamble);
+            optPtr->decode(buffer, offset_map);
+            ptr = shared_resource_base_t(optPtr);
+          }
+            break;
           default:
           {
             // An unknown record. Save the data and move on.
@@ -2817,6 +3151,7 @@ namespace boost
             break;
           }
 
+          ptr->rr_domain.swap(owner);
           return ptr;
         }
       };
@@ -14,8 +14,14 @@
 #ifndef BOOST_NET_DNS_CACHE_HPP
 #define BOOST_NET_DNS_CACHE_HPP
 
+#include <cstring>
+#include <map>
 #include <vector>
+#include <algorithm>
 #include <boost/net/dns.hpp>
+#include <boost/net/dns_cache_policy.hpp>
+#include <boost/net/dns_cache_filter.hpp>
+#include <boost/net/dns_name_tree.hpp>
 
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/multi_index_container.hpp>
@@ -24,6 +30,9 @@
 #include <boost/multi_index/ordered_index.hpp>
 #include <boost/multi_index/hashed_index.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/atomic.hpp>
 
 using namespace boost::multi_index;
 using namespace boost::posix_time;
@@ -36,360 +45,1567 @@ namespace boost
     namespace dns
     {
 
+      /*!
+       Kind of a cached negative answer, RFC 2308
+       */
+      typedef enum
+      {
+        negative_none = 0, //!< Not a negative answer
+        negative_nxdomain, //!< The name does not exist
+        negative_nodata
+      //!< The name exists, but has no records of the type asked for
+      } negative_t;
+
+      //! A shared, immutable RRset handed out by the cache
+      typedef shared_ptr< const rr_list_t > shared_rrset_t;
+
+      /*!
+       A cached RRset as exported by basic_dns_cache::entries()
+       */
+      struct dns_cache_entry
+      {
+        /// Question the RRset answers
+        question q;
+        /// The records, the SOA for a negative answer
+        shared_rrset_t records;
+        /// Kind of negative answer, negative_none for an RRset
+        negative_t negative;
+        /// Seconds of TTL left when exported
+        uint32_t ttl;
+      };
+
+      /*!
+       TTL of the records lookup_stale() returns for an expired RRset, the 30 seconds
+       RFC 8767 section 4 recommends. The cache keeps the expired records as they are,
+       callers get copies.
+       */
+      const uint32_t stale_ttl = 30;
+
+      /*!
+       Cache counters for one record type
+       */
+      struct dns_cache_type_stats
+      {
+        /// Lookups answered from the cache
+        std::size_t hits;
+        /// Lookups that went unanswered
+        std::size_t misses;
+        /// Number of cached RRsets
+        std::size_t entries;
+
+        dns_cache_type_stats () :
+          hits(0), misses(0), entries(0)
+        {
+        }
+      };
+
+      /*!
+       Cache occupancy and activity counters, see basic_dns_cache::stats()
+       */
+      struct dns_cache_stats
+      {
+        /// Approximate memory held by cached records
+        std::size_t bytes;
+        /// Number of cached RRsets
+        std::size_t entries;
+        /// Lookups answered from the cache, negative answers included
+        std::size_t hits;
+        /// Lookups answered with a cached negative answer
+        std::size_t negative_hits;
+        /// Expired RRsets from lookup_stale() that went to a caller
+        std::size_t stale_hits;
+        /// Lookups that went unanswered
+        std::size_t misses;
+        /// Misses turned away by the prefilter without taking the cache lock, part of
+        /// misses but not of the per type counts
+        std::size_t filtered;
+        /// RRsets cached
+        std::size_t inserts;
+        /// RRsets a lookup found expired, each counted once
+        std::size_t expirations;
+        /// RRsets evicted to make room
+        std::size_t evictions;
+        /// RRsets dropped once expired past the stale window
+        std::size_t expired;
+        /// RRsets replaced by a newer set for the same question
+        std::size_t replaced;
+        /// RRsets dropped by flush()
+        std::size_t flushed;
+        /// RRsets kept out of a full cache by the admission doorkeeper, or because they
+        /// don't fit the byte budget
+        std::size_t rejected;
+        /// Breakdown by record type, only types that were seen are present
+        std::map< type_t, dns_cache_type_stats > types;
+
+        dns_cache_stats () :
+          bytes(0), entries(0), hits(0), negative_hits(0), stale_hits(0), misses(0), filtered(0), inserts(0), expirations(0),
+              evictions(0), expired(0), replaced(0), flushed(0), rejected(0), types()
+        {
+        }
+      };
+
       /*!
        Implementation for a simple DNS cache.
        This cache uses two methods to remove a "stale" record.
 
-       #1 - Expiration date
+       #1 - Expiration date
+
+       #2 - Eviction policy, one of lru_policy, clock_policy or tinylfu_policy
+
+       Records are cached as RRsets, one entry per owner name, type and class.
+       Negative answers (NXDOMAIN and NODATA) are cached per question, holding the SOA
+       from the authority section for its negative TTL.
+
+       With prefetching enabled, a lookup that hits a popular RRset close to its expiry
+       asks the caller to refresh it, so hot names never fall out of the cache.
+
+       With serve-stale enabled (RFC 8767), expired RRsets are kept for a stale window.
+       Normal lookups treat them as misses, lookup_stale() still returns them so a
+       resolver can answer from them when the upstreams are slow or down.
+
+       The capacity is either an RRset count, or a byte budget where every RRset is
+       charged its approximate footprint (names, rdata and index overhead).
+
+       Lookups follow cached CNAME chains, so an alias whose target is cached is
+       answered without asking upstream.
+
+       With the name index enabled, RRsets are also indexed by owner name in a
+       dns_name_tree, so flush() of a domain only visits the names under it, and
+       closest_ns() walks up from the name instead of probing every ancestor.
+       */
+      template<template<typename > class EvictionPolicy = lru_policy>
+        class basic_dns_cache
+        {
+        private:
+
+          /*!
+
+           */
+          struct dns_hasher
+          {
+          public:
+            /*!
+             */
+            static size_t
+            query ( const string& domain, const type_t rType, const class_t rClass = class_in )
+            {
+              boost::hash< string > hString;
+              boost::hash< type_t > hType;
+              boost::hash< class_t > hClass;
+              return size_t(hString(domain) + hType(rType) + hClass(rClass));
+            }
+
+            /*!
+             */
+            static std::size_t
+            query ( const request_base_t& dnr )
+            {
+              return query(dnr.domain(), dnr.rtype(), dnr.rclass());
+            }
+
+            /*!
+             */
+            static std::size_t
+            query ( const shared_resource_base_t& dnr )
+            {
+              return query(dnr->domain(), dnr->rtype(), dnr->rclass());
+            }
+
+            /*!
+             */
+            static std::size_t
+            record ( const shared_resource_base_t& rr )
+            {
+              std::size_t hashCode(dns_hasher::query(rr));
+
+              boost::hash< uint32_t > h32;
+              boost::hash< string > hString;
+
+              switch( rr->rtype() )
+              {
+              case type_a:
+                hashCode += h32( ( (a_resource*) rr.get() )->address().to_ulong());
+                break;
+              case type_ns:
+                hashCode += hString( ( (ns_resource*) rr.get() )->nameserver());
+                break;
+              case type_cname:
+                hashCode += hString( ( (cname_resource*) rr.get() )->canonicalname());
+                break;
+              case type_soa:
+                hashCode += h32( ( (soa_resource*) rr.get() )->serial_number());
+                break;
+              case type_ptr:
+                hashCode += hString( ( (ptr_resource*) rr.get() )->pointer());
+                break;
+              case type_mx:
+                hashCode += hString( ( (mx_resource*) rr.get() )->exchange()) + h32(
+                    ( (mx_resource*) rr.get() )->preference());
+                break;
+
+              case type_a6:
+              case type_srv:
+                break;
+
+              case type_none:
+              case type_hinfo:
+              case type_txt:
+              case type_opt:
+              case type_axfr:
+              case type_all:
+                break;
+
+              }
+
+              return hashCode;
+            }
+          };
+
+          /*!
+           Approximate memory footprint of a cached record
+           */
+          struct dns_sizer
+          {
+          public:
+            /*!
+             */
+            static std::size_t
+            record ( const shared_resource_base_t& rr )
+            {
+              std::size_t bytes(rr->domain().capacity());
+
+              switch( rr->rtype() )
+              {
+              case type_a:
+                bytes += sizeof(a_resource);
+                break;
+              case type_ns:
+                bytes += sizeof(ns_resource) + ( (ns_resource*) rr.get() )->nameserver().capacity();
+                break;
+              case type_cname:
+                bytes += sizeof(cname_resource) + ( (cname_resource*) rr.get() )->canonicalname().capacity();
+                break;
+              case type_soa:
+                bytes += sizeof(soa_resource) + ( (soa_resource*) rr.get() )->master_name().capacity()
+                    + ( (soa_resource*) rr.get() )->responsible_name().capacity();
+                break;
+              case type_ptr:
+                bytes += sizeof(ptr_resource) + ( (ptr_resource*) rr.get() )->pointer().capacity();
+                break;
+              case type_hinfo:
+                bytes += sizeof(hinfo_resource) + ( (hinfo_resource*) rr.get() )->cpu().capacity()
+                    + ( (hinfo_resource*) rr.get() )->os().capacity();
+                break;
+              case type_mx:
+                bytes += sizeof(mx_resource) + ( (mx_resource*) rr.get() )->exchange().capacity();
+                break;
+              case type_txt:
+                bytes += sizeof(txt_resource) + ( (txt_resource*) rr.get() )->text().capacity();
+                break;
+              case type_a6:
+                bytes += sizeof(a6_resource);
+                break;
+              case type_srv:
+                bytes += sizeof(srv_resource) + ( (srv_resource*) rr.get() )->targethost().capacity();
+                break;
+
+              case type_none:
+              case type_axfr:
+              case type_all:
+              default:
+                bytes += sizeof(unknown_resource) + rr->length();
+                break;
+              }
+
+              // shared_ptr control block
+              return bytes + 2 * sizeof(long);
+            }
+
+            /*!
+             */
+            static std::size_t
+            rrset ( const rr_list_t& records )
+            {
+              std::size_t bytes(records.capacity() * sizeof(shared_resource_base_t));
+              for( rr_list_t::const_iterator iter = records.begin(); iter != records.end(); ++iter )
+                bytes += record( ( *iter ));
+
+              return bytes;
+            }
+
+            /*!
+             Cache entry, its shared_ptr control block and the hashed index node
+             */
+            static std::size_t
+            overhead ()
+            {
+              return sizeof(rr_cache) + 2 * sizeof(long) + 3 * sizeof(void*);
+            }
+          };
+
+          /*!
+           A cached RRset: every record for one owner name, type and class, sharing one TTL.
+           A negative answer holds the SOA of the answer instead.
+           */
+          struct rr_cache
+          {
+            size_t _qHash;
+            question _question;
+            uint32_t _hits;
+            time_period _expirationTime;
+            ptime _timeRetrieved;
+            bool _perm;
+            std::size_t _bytes;
+            negative_t _negative;
+            /// A prefetch for this RRset is in flight
+            bool _refreshing;
+            /// A lookup found the RRset expired, so the expiry was counted
+            bool _lapsed;
+
+            /// Eviction policy bookkeeping
+            typename EvictionPolicy< rr_cache >::hook_type _policy_hook;
+
+            /// Name index bookkeeping
+            typename dns_name_tree< rr_cache >::hook_type _name_hook;
+
+            /// Never modified once cached, hits share it
+            shared_rrset_t records;
+
+            /*!
+             The TTL of the set is the lowest TTL of its records.
+             */
+            rr_cache ( const question& q, const rr_list_t& rrset, const bool perm ) :
+              _qHash(dns_hasher::query(q)), _question(q), _hits(0), _expirationTime(second_clock::local_time(),
+                  seconds(min_ttl(rrset))), _timeRetrieved(second_clock::local_time()), _perm(perm), _bytes(0),
+                  _negative(negative_none), _refreshing(false), _lapsed(false), _policy_hook(), _name_hook(),
+                  records(new rr_list_t(rrset))
+            {
+            }
+
+            /*!
+             Negative answer for q. The negative TTL is the lesser of the SOA TTL and the SOA minimum.
+             */
+            rr_cache ( const question& q, const shared_resource_base_t& soa, const negative_t negative ) :
+              _qHash(dns_hasher::query(q)), _question(q), _hits(0), _expirationTime(second_clock::local_time(),
+                  seconds(( std::min )(soa->ttl(), ( (soa_resource*) soa.get() )->minttl()))), _timeRetrieved(
+                  second_clock::local_time()), _perm(false), _bytes(0), _negative(negative), _refreshing(false),
+                  _lapsed(false), _policy_hook(), _name_hook(), records(new rr_list_t(1, soa))
+            {
+            }
+
+            /*!
+             Restored RRset that expires ttl seconds after nowTime, sharing the restored records.
+             */
+            rr_cache ( const question& q, const shared_rrset_t& rrset, const negative_t negative, const ptime& nowTime,
+                const uint32_t ttl ) :
+              _qHash(dns_hasher::query(q)), _question(q), _hits(0), _expirationTime(nowTime, seconds(ttl)),
+                  _timeRetrieved(nowTime), _perm(false), _bytes(0), _negative(negative), _refreshing(false),
+                  _lapsed(false), _policy_hook(), _name_hook(), records(rrset)
+            {
+            }
+
+            /*!
+             */
+            virtual
+            ~rr_cache ()
+            {
+            }
+
+            /*!
+             */
+            bool
+            expired () const
+            {
+              if( _perm )
+                return false;
+
+              ptime nowTime = second_clock::local_time();
+              return ( !_expirationTime.contains(nowTime) );
+            }
+
+            /*!
+             True when expired for longer than the stale window
+             */
+            bool
+            dead ( const time_duration& window ) const
+            {
+              if( !expired() )
+                return false;
+
+              return second_clock::local_time() > _expirationTime.last() + window;
+            }
+
+            /*!
+             True when less than fraction of the TTL is left
+             */
+            bool
+            expiring ( const double fraction ) const
+            {
+              if( _perm )
+                return false;
+
+              time_duration left(_expirationTime.last() - second_clock::local_time());
+              return left.total_seconds() <= fraction * _expirationTime.length().total_seconds();
+            }
+
+            /*!
+             The question hash is the container key, this guards against hash collisions.
+             */
+            bool
+            matches ( const request_base_t& q ) const
+            {
+              return _question.rtype() == q.rtype() && _question.rclass() == q.rclass() && _question.domain()
+                  == q.domain();
+            }
+
+            uint32_t
+            hits () const
+            {
+              if( _perm )
+                return 0xFFFFFFFF;
+
+              return _hits;
+            }
+
+            /// Key the eviction policy counts lookups against
+            std::size_t
+            policy_key () const
+            {
+              return _qHash;
+            }
+
+            /*!
+             */
+            static uint32_t
+            min_ttl ( const rr_list_t& rrset )
+            {
+              uint32_t ttl(rrset.empty() ? 0 : rrset.front()->ttl());
+              for( rr_list_t::const_iterator iter = rrset.begin(); iter != rrset.end(); ++iter )
+                ttl = ( std::min )(ttl, ( *iter )->ttl());
+
+              return ttl;
+            }
+
+          };
+          /*!
+           */
+          typedef shared_ptr< rr_cache > shared_rr_cache;
+
+          struct by_q
+          {
+          };
+#if !defined(GENERATING_DOCUMENTATION)
+          /*!
+           One node and one hashed index entry per RRset
+           */
+          typedef boost::multi_index::multi_index_container< shared_rr_cache, boost::multi_index::indexed_by<
+              boost::multi_index::hashed_unique< boost::multi_index::tag< by_q >, boost::multi_index::member<
+                  rr_cache, std::size_t, &rr_cache::_qHash > > > > rr_container_t;
+#endif
+          typedef typename rr_container_t::template index< by_q >::type::iterator q_iter_t;
+
+          typedef EvictionPolicy< rr_cache > policy_t;
+
+          typedef dns_name_tree< rr_cache > name_tree_t;
+
+          enum
+          {
+            /// Types with a value below this are counted separately, the others as type_none
+            type_slots = 64
+          };
+
+          /*!
+           Activity counters, only written under the cache lock
+           */
+          struct counters
+          {
+            std::size_t _hits;
+            std::size_t _negative_hits;
+            std::size_t _stale_hits;
+            std::size_t _misses;
+            std::size_t _inserts;
+            std::size_t _expirations;
+            std::size_t _evictions;
+            std::size_t _expired;
+            std::size_t _replaced;
+            std::size_t _flushed;
+            std::size_t _rejected;
+            std::size_t _type_hits[type_slots];
+            std::size_t _type_misses[type_slots];
+            std::size_t _type_entries[type_slots];
+          };
+
+          ///
+          rr_container_t _cache;
+          ///
+          const uint32_t _max_elements;
+          /// Byte budget, 0 when the capacity is counted in RRsets
+          const std::size_t _max_bytes;
+          ///
+          std::size_t _bytes;
+          /// Activity counters, see stats()
+          counters _counters;
+          ///
+          policy_t _policy;
+          /// Fraction of the TTL left at which a hit triggers a prefetch, 0 disables prefetching
+          double _prefetch_fraction;
+          /// Hits an RRset needs before it is prefetched
+          uint32_t _prefetch_hits;
+          /// Most prefetches allowed in flight
+          std::size_t _prefetch_max;
+          ///
+          std::size_t _prefetch_inflight;
+          /// How long expired RRsets are kept to be served stale
+          time_duration _stale_window;
+          boost::atomic< bool > _serving_stale;
+          /// Owner name index, 0 when disabled
+          scoped_ptr< name_tree_t > _names;
+          /// Admission doorkeeper, 0 when every RRset is admitted
+          scoped_ptr< frequency_sketch > _doorkeeper;
+          /// Prefilter, kept once created so lock free readers never see it deleted
+          scoped_ptr< dns_cache_filter > _filterStorage;
+          /// Prefilter consulted by lookups, 0 when disabled
+          boost::atomic< dns_cache_filter* > _filter;
+          ///
+          boost::mutex _mutex;
+
+        public:
+          enum
+          {
+            /// Most CNAMEs a lookup follows
+            max_chain = 8
+          };
+
+          /*!
+           \param max_elements Number of RRsets the cache holds before evicting. With a byte
+           budget, the number of RRsets the eviction policy is sized for.
+           \param max_bytes Byte budget for the cache, 0 to limit by max_elements
+           */
+          explicit
+          basic_dns_cache ( const uint32_t max_elements = 16, const std::size_t max_bytes = 0 ) :
+            _max_elements(max_elements), _max_bytes(max_bytes), _bytes(0), _policy(max_elements),
+                _prefetch_fraction(0.0), _prefetch_hits(0), _prefetch_max(0), _prefetch_inflight(0),
+                _stale_window(seconds(0)), _serving_stale(false), _names(), _doorkeeper(), _filterStorage(),
+                _filter(0)
+          {
+            std::memset(&_counters, 0, sizeof ( _counters ));
+          }
+
+          /*!
+           Keeps expired RRsets around for lookup_stale(), RFC 8767.
+
+           \param window How long past its expiry an RRset may still be served, 0 disables serve-stale
+           */
+          void
+          serve_stale ( const time_duration& window )
+          {
+            boost::mutex::scoped_lock scopeLock(_mutex);
+            _stale_window = window;
+            _serving_stale.store(window > seconds(0), boost::memory_order_relaxed);
+          }
+
+          /*!
+           True when serve_stale() set a window, read without the lock so callers can
+           skip lookup_stale() when it can't answer.
+           */
+          bool
+          serves_stale ( ) const
+          {
+            return _serving_stale.load(boost::memory_order_relaxed);
+          }
+
+          /*!
+           Enables or disables the owner name index. Enabling it indexes the RRsets
+           already cached.
+           */
+          void
+          name_index ( const bool enable )
+          {
+            boost::mutex::scoped_lock scopeLock(_mutex);
+
+            if( !enable )
+            {
+              for( q_iter_t iter = _cache.template get< by_q > ().begin(); iter != _cache.template get< by_q > ().end(); ++iter )
+                ( *iter )->_name_hook = typename name_tree_t::hook_type();
+
+              _names.reset();
+              return;
+            }
+
+            if( _names )
+              return;
+
+            _names.reset(new name_tree_t());
+            for( q_iter_t iter = _cache.template get< by_q > ().begin(); iter != _cache.template get< by_q > ().end(); ++iter )
+              _names->insert(*( *iter ), ( *iter )->_question.domain());
+          }
+
+          /*!
+           Enables or disables frequency based admission. A count-min sketch counts the
+           hits and fills of every question; once the cache is full, a new RRset is only
+           cached if it is estimated to be more popular than the RRset it would evict.
+           A burst of one-off names then bounces off the cache instead of flushing the
+           working set. reserve() doesn't evict ahead of the answers while it's enabled.
+
+           Meant for the LRU and CLOCK policies, W-TinyLFU already filters its
+           candidates this way.
+           */
+          void
+          admission ( const bool enable )
+          {
+            boost::mutex::scoped_lock scopeLock(_mutex);
+
+            if( !enable )
+              _doorkeeper.reset();
+            else if( !_doorkeeper )
+              // wider than the policy sketches, under attack most fills it counts are one-off names
+              _doorkeeper.reset(new frequency_sketch(4 * std::size_t(_max_elements)));
+          }
+
+          /*!
+           Enables or disables the lookup prefilter, a counting Bloom filter over the
+           cached questions. With it a lookup for a question that is definitely not
+           cached misses without taking the cache lock. Enabling it fills the filter
+           from the RRsets already cached.
+
+           Lookups turned away by the filter aren't recorded by the eviction policy.
+           */
+          void
+          prefilter ( const bool enable )
+          {
+            boost::mutex::scoped_lock scopeLock(_mutex);
+
+            if( !enable )
+            {
+              _filter.store(0, boost::memory_order_release);
+              return;
+            }
+
+            if( _filter.load(boost::memory_order_relaxed) )
+              return;
+
+            if( !_filterStorage )
+              _filterStorage.reset(new dns_cache_filter(std::max< std::size_t >(_max_elements, _cache.size())));
+            else
+              _filterStorage->clear();
+
+            for( q_iter_t iter = _cache.template get< by_q > ().begin(); iter != _cache.template get< by_q > ().end(); ++iter )
+              _filterStorage->add(( *iter )->_qHash);
+
+            _filter.store(_filterStorage.get(), boost::memory_order_release);
+          }
+
+          /*!
+           Enables refresh-ahead prefetching.
+
+           \param fraction Fraction of the TTL left at which a hit asks for a refresh, 0 disables prefetching
+           \param max_inflight Most prefetches in flight at once, so refreshes can't swamp the upstreams
+           \param min_hits Hits an RRset needs before it is worth refreshing
+           */
+          void
+          prefetch ( const double fraction, const std::size_t max_inflight, const uint32_t min_hits = 2 )
+          {
+            boost::mutex::scoped_lock scopeLock(_mutex);
+            _prefetch_fraction = fraction;
+            _prefetch_max = max_inflight;
+            _prefetch_hits = min_hits;
+          }
+
+          /*!
+           Releases the prefetch budget taken by a lookup that returned refresh. Called when
+           the refresh finishes, whether it succeeded or not.
+           */
+          void
+          prefetch_done ( const question& q )
+          {
+            boost::mutex::scoped_lock scopeLock(_mutex);
+
+            if( _prefetch_inflight )
+              --_prefetch_inflight;
+
+            // a successful refresh replaced the entry, a failed one may try again
+            q_iter_t iter = _cache.template get< by_q > ().find(dns_hasher::query(q));
+            if( iter != _cache.template get< by_q > ().end() && ( *iter )->matches(q) )
+              ( *iter )->_refreshing = false;
+          }
+
+          /*!
+           */
+          bool
+          exists ( const question& q )
+          {
+            if( filtered(q, false) )
+              return false;
+
+            boost::mutex::scoped_lock scopeLock(_mutex);
+
+            q_iter_t iter = _cache.template get< by_q > ().find(dns_hasher::query(q));
+            if( iter == _cache.template get< by_q > ().end() )
+              return false;
+
+            return ( *iter )->matches(q) && !( *iter )->expired();
+          }
+
+          /*!
+           Looks up an RRset that may have expired within the stale window. Used to answer
+           when the upstreams don't respond in time. An expired set comes back as copies of
+           its records with a TTL of stale_ttl, and isn't counted until stale_served().
+
+           \param q Question to look up
+           \param negative Set to the kind of negative answer when one is cached
+           \return The cached set, fresh or stale, empty on a miss
+           */
+          shared_rrset_t
+          lookup_stale ( const question& q, negative_t& negative )
+          {
+            negative = negative_none;
+
+            if( filtered(q, false) )
+              return shared_rrset_t();
+
+            shared_rrset_t records;
+            {
+              boost::mutex::scoped_lock scopeLock(_mutex);
+
+              q_iter_t iter = _cache.template get< by_q > ().find(dns_hasher::query(q));
+              if( iter == _cache.template get< by_q > ().end() || !( *iter )->matches(q) )
+                return shared_rrset_t();
+
+              if( ( *iter )->dead(_stale_window) )
+              {
+                ++_counters._expired;
+                erase(iter);
+                return shared_rrset_t();
+              }
+
+              _policy.touched(*( *iter ));
+
+              negative = ( *iter )->_negative;
+              if( !( *iter )->expired() )
+                return ( *iter )->records;
+
+              lapsed(*( *iter ));
+              records = ( *iter )->records;
+            }
+
+            shared_ptr< rr_list_t > stale(boost::make_shared< rr_list_t >());
+            for( rr_list_t::const_iterator iter = records->begin(); iter != records->end(); ++iter )
+            {
+              shared_resource_base_t rr(( *iter )->clone());
+              rr->ttl(stale_ttl);
+              stale->push_back(rr);
+            }
+
+            return stale;
+          }
+
+          /*!
+           Counts an expired RRset from lookup_stale() that went to a caller, see
+           dns_cache_stats::stale_hits.
+           */
+          void
+          stale_served ( )
+          {
+            boost::mutex::scoped_lock scopeLock(_mutex);
+            ++_counters._stale_hits;
+          }
+
+          /*!
+           */
+          bool
+          exists ( const std::string& domain, const type_t rType )
+          {
+            question q(domain, rType);
+            return exists(q);
+          }
+
+          /*!
+           Expired records are dropped as they are found. A cached negative answer
+           returns an empty list.
+           */
+          rr_list_t
+          get ( const question& q )
+          {
+            negative_t negative;
+            rr_list_t retList(get(q, negative));
+            if( negative != negative_none )
+              retList.clear();
+
+            return retList;
+          }
+
+          /*!
+           Expired records are dropped as they are found.
+
+           \param q Question to look up
+           \param negative Set to the kind of negative answer when one is cached, in which
+           case the list holds the SOA of the negative answer.
+           */
+          rr_list_t
+          get ( const question& q, negative_t& negative )
+          {
+            shared_rrset_t rrset(lookup(q, negative));
+            if( !rrset )
+              return rr_list_t();
+
+            return *rrset;
+          }
+
+          /*!
+           Looks up the cached RRset for a question without copying it. A hit costs a single
+           reference count, whatever the size of the set.
 
-       #2 - Hit count
+           When the name is an alias, the lookup follows the cached CNAMEs and answers with
+           the chain followed by the target's RRset, built from the cached pieces.
 
-       */
-      class dns_cache_t
-      {
-      private:
+           \param q Question to look up
+           \param negative Set to the kind of negative answer when one is cached, in which
+           case the set holds the SOA of the negative answer.
+           \return The cached set, empty on a miss
+           */
+          shared_rrset_t
+          lookup ( const question& q, negative_t& negative )
+          {
+            return lookup(q, negative, 0);
+          }
+
+          /*!
+           Looks up the cached RRset for a question, and tells the caller when it should be
+           prefetched. A caller that gets refresh set must requery the question and call
+           prefetch_done() once the query has finished.
+
+           \param q Question to look up
+           \param negative Set to the kind of negative answer when one is cached
+           \param refresh Set when the RRset is popular and about to expire
+           \return The cached set, empty on a miss
+           */
+          shared_rrset_t
+          lookup ( const question& q, negative_t& negative, bool& refresh )
+          {
+            return lookup(q, negative, &refresh);
+          }
+
+        private:
+          shared_rrset_t
+          lookup ( const question& q, negative_t& negative, bool* refresh )
+          {
+            if( refresh )
+              *refresh = false;
 
-        /*!
+            negative = negative_none;
+
+            if( filtered(q) )
+              return shared_rrset_t();
+
+            boost::mutex::scoped_lock scopeLock(_mutex);
+
+            shared_rrset_t rrset;
+            rr_cache* entry(hit(q, refresh));
+            if( entry )
+            {
+              negative = entry->_negative;
+              rrset = entry->records;
+            }
+            else if( q.rtype() != type_cname && q.rtype() != type_all )
+              rrset = chase(q, negative);
+
+            counters& c(_counters);
+            if( rrset )
+            {
+              ++c._hits;
+              ++c._type_hits[type_slot(q.rtype())];
+              if( negative != negative_none )
+                ++c._negative_hits;
+            }
+            else
+            {
+              ++c._misses;
+              ++c._type_misses[type_slot(q.rtype())];
+            }
+
+            return rrset;
+          }
+
+          /*!
+           True when the prefilter knows q can't be answered from the cache: neither
+           the question nor a CNAME for its name is cached. Only a lookup() counts the
+           rejection, the other paths would count the same miss twice.
+           */
+          bool
+          filtered ( const question& q, const bool count = true )
+          {
+            dns_cache_filter* filter(_filter.load(boost::memory_order_acquire));
+            if( !filter || filter->may_contain(dns_hasher::query(q)) )
+              return false;
+
+            if( q.rtype() != type_cname && q.rtype() != type_all
+                && filter->may_contain(dns_hasher::query(q.domain(), type_cname, q.rclass())) )
+              return false;
+
+            if( count )
+              filter->rejected();
+            return true;
+          }
+
+          /*!
+           Follows cached CNAMEs from the name of q to a cached RRset of the type asked
+           for, and puts the answer together: the CNAMEs in chain order, then the set.
+           A chain that ends in a cached negative answer returns that answer.
+
+           Misses when a link isn't cached, when the chain is longer than max_chain, or
+           when it loops.
+           */
+          shared_rrset_t
+          chase ( const question& q, negative_t& negative )
+          {
+            shared_ptr< rr_list_t > answer(new rr_list_t());
+            std::vector< std::string > seen(1, q.domain());
+
+            std::string name(q.domain());
+            for( std::size_t depth = 0; depth < max_chain; ++depth )
+            {
+              rr_cache* alias(hit(question(name, type_cname, q.rclass()), 0));
+              if( !alias || alias->_negative != negative_none || alias->records->empty() )
+                return shared_rrset_t();
+
+              answer->insert(answer->end(), alias->records->begin(), alias->records->end());
+              name = ( (cname_resource*) alias->records->front().get() )->canonicalname();
+
+              if( std::find(seen.begin(), seen.end(), name) != seen.end() )
+                return shared_rrset_t();
+              seen.push_back(name);
+
+              rr_cache* target(hit(question(name, q.rtype(), q.rclass()), 0));
+              if( !target )
+                continue;
+
+              negative = target->_negative;
+              if( negative != negative_none )
+                return target->records;
+
+              answer->insert(answer->end(), target->records->begin(), target->records->end());
+              return answer;
+            }
+
+            return shared_rrset_t();
+          }
+
+          /*!
+           Finds the live RRset for q, counting the hit. Expired RRsets miss, and are
+           dropped once they are past the stale window.
+
+           \param refresh When not 0, set if the hit should trigger a prefetch
+           */
+          rr_cache*
+          hit ( const question& q, bool* refresh )
+          {
+            size_t qHash(dns_hasher::query(q));
+            _policy.record(qHash);
+
+            q_iter_t iter = _cache.template get< by_q > ().find(qHash);
+            if( iter == _cache.template get< by_q > ().end() || !( *iter )->matches(q) )
+              return 0;
+
+            if( ( *iter )->expired() )
+            {
+              lapsed(*( *iter ));
+
+              // stale RRsets stay around for lookup_stale()
+              if( ( *iter )->dead(_stale_window) )
+              {
+                ++_counters._expired;
+                erase(iter);
+              }
+
+              return 0;
+            }
+
+            ( *iter )->_hits++;
+            ( *iter )->_timeRetrieved = second_clock::local_time();
+            _policy.touched(*( *iter ));
+            if( _doorkeeper )
+              _doorkeeper->increment(qHash);
+
+            if( refresh && _prefetch_fraction > 0.0 && _prefetch_inflight < _prefetch_max && !( *iter )->_refreshing
+                && ( *iter )->_hits >= _prefetch_hits && ( *iter )->expiring(_prefetch_fraction) )
+            {
+              ( *iter )->_refreshing = true;
+              ++_prefetch_inflight;
+              *refresh = true;
+            }
+
+            return iter->get();
+          }
 
-         */
-        struct dns_hasher
-        {
         public:
+
           /*!
            */
-          static size_t
-          query ( const string& domain, const type_t rType, const class_t rClass = class_in )
+          rr_list_t
+          get ( const std::string& domain, const type_t rType )
           {
-            boost::hash< string > hString;
-            boost::hash< type_t > hType;
-            boost::hash< class_t > hClass;
-            return size_t(hString(domain) + hType(rType) + hClass(rClass));
+            question q(domain, rType);
+            return get(q);
           }
 
           /*!
+           Adds a record to the cached RRset of its owner, type and class. The set keeps
+           the lowest TTL of its records.
            */
-          static std::size_t
-          query ( const request_base_t& dnr )
+          void
+          add ( const shared_resource_base_t& rr, const bool perm = false )
           {
-            return query(dnr.domain(), dnr.rtype(), dnr.rclass());
+            boost::mutex::scoped_lock scopeLock(_mutex);
+
+            question q(*rr.get());
+            rr_list_t rrset(1, rr);
+
+            q_iter_t iter = _cache.template get< by_q > ().find(dns_hasher::query(q));
+            if( iter != _cache.template get< by_q > ().end() && ( *iter )->matches(q) && !( *iter )->expired()
+                && ( *iter )->_negative == negative_none )
+            {
+              size_t rHash(dns_hasher::record(rr));
+              const rr_list_t& cached(*( *iter )->records);
+              for( rr_list_t::const_iterator rIter = cached.begin(); rIter != cached.end(); ++rIter )
+              {
+                if( dns_hasher::record( ( *rIter )) != rHash )
+                  rrset.push_back( ( *rIter ));
+              }
+            }
+
+            replace(q, rrset, perm);
           }
 
           /*!
+           Adds records, grouped into RRsets by owner, type and class. Every set replaces
+           the cached set for its question.
            */
-          static std::size_t
-          query ( const shared_resource_base_t& dnr )
+          void
+          add ( const rr_list_t& records, const bool perm = false )
           {
-            return query(dnr->domain(), dnr->rtype(), dnr->rclass());
+            std::vector< rr_list_t > rrsets;
+            for( rr_list_t::const_iterator iter = records.begin(); iter != records.end(); ++iter )
+            {
+              std::vector< rr_list_t >::iterator set = rrsets.begin();
+              for( ; set != rrsets.end(); ++set )
+              {
+                const shared_resource_base_t& first(set->front());
+                if( first->rtype() == ( *iter )->rtype() && first->rclass() == ( *iter )->rclass()
+                    && first->domain() == ( *iter )->domain() )
+                  break;
+              }
+
+              if( set == rrsets.end() )
+                rrsets.push_back(rr_list_t(1, ( *iter )));
+              else
+                set->push_back( ( *iter ));
+            }
+
+            boost::mutex::scoped_lock scopeLock(_mutex);
+            for( std::vector< rr_list_t >::iterator set = rrsets.begin(); set != rrsets.end(); ++set )
+              replace(question(*set->front().get()), *set, perm);
           }
 
           /*!
+           Caches a negative answer for a question, replacing anything cached for it.
+
+           \param q Question that was answered negatively
+           \param soa SOA record from the authority section of the answer
+           \param negative Kind of negative answer
            */
-          static std::size_t
-          record ( const shared_resource_base_t& rr )
-          {
-            std::size_t hashCode(dns_hasher::query(rr));
-
-            boost::hash< uint32_t > h32;
-            boost::hash< string > hString;
-
-            switch( rr->rtype() )
-            {
-            case type_a:
-              hashCode += h32( ( (a_resource*) rr.get() )->address().to_ulong());
-              break;
-            case type_ns:
-              hashCode += hString( ( (ns_resource*) rr.get() )->nameserver());
-              break;
-            case type_cname:
-              hashCode += hString( ( (cname_resource*) rr.get() )->canonicalname());
-              break;
-            case type_soa:
-              hashCode += h32( ( (soa_resource*) rr.get() )->serial_number());
-              break;
-            case type_ptr:
-              hashCode += hString( ( (ptr_resource*) rr.get() )->pointer());
-              break;
-            case type_mx:
-              hashCode += hString( ( (mx_resource*) rr.get() )->exchange()) + h32(
-                  ( (mx_resource*) rr.get() )->preference());
-              break;
-
-            case type_a6:
-            case type_srv:
-              break;
-
-            case type_none:
-            case type_hinfo:
-            case type_txt:
-            case type_axfr:
-            case type_all:
-              break;
-
-            }
-
-            return hashCode;
+          void
+          add_negative ( const question& q, const shared_resource_base_t& soa, const negative_t negative )
+          {
+            BOOST_ASSERT(soa->rtype() == type_soa);
+
+            boost::mutex::scoped_lock scopeLock(_mutex);
+
+            shared_rr_cache rrItem(new rr_cache(q, soa, negative));
+            rrItem->_bytes = dns_sizer::rrset(*rrItem->records) + dns_sizer::overhead();
+
+            insert(rrItem, q);
           }
-        };
 
-        /*!
-         */
-        struct rr_cache
-        {
-          size_t _rHash;
-          size_t _qHash;
-          size_t _dHash;
-          uint32_t _hits;
-          time_period _expirationTime;
-          ptime _timeRetrieved;
-          bool _perm;
+          /*!
+           Makes room for reserve_count RRsets, without evicting any RRsets for the domain of q.
+           */
+          void
+          reserve ( const size_t reserve_count, request_base_t& q )
+          {
+            boost::mutex::scoped_lock scopeLock(_mutex);
+
+            // the doorkeeper decides on eviction once the records are there
+            if( _doorkeeper )
+              return;
 
-          shared_resource_base_t record;
+            // without knowing the records yet, budget them at the average footprint
+            size_t avgBytes(_cache.size() ? _bytes / _cache.size() : dns_sizer::overhead() + sizeof(a_resource));
+            evict(reserve_count, reserve_count * avgBytes, q);
+          }
 
           /*!
+           Exports every live RRset with its remaining TTL. Permanent and expired RRsets are left out.
+           Only the shared record lists are copied while the cache is locked.
            */
-          rr_cache ( const shared_resource_base_t& rr, const bool perm ) :
-            _hits(0), _expirationTime(second_clock::local_time(), seconds(rr->ttl())), _timeRetrieved(
-                second_clock::local_time()), _perm(perm), record(rr)
+          void
+          entries ( std::vector< dns_cache_entry >& out )
           {
-            _rHash = dns_hasher::record(rr);
-            _qHash = dns_hasher::query(rr);
+            boost::mutex::scoped_lock scopeLock(_mutex);
+
+            ptime nowTime(second_clock::local_time());
+            out.reserve(out.size() + _cache.size());
 
-            boost::hash< string > hString;
-            _dHash = hString(record.get()->domain());
+            for( q_iter_t iter = _cache.template get< by_q > ().begin(); iter != _cache.template get< by_q > ().end(); ++iter )
+            {
+              if( ( *iter )->_perm || ( *iter )->expired() )
+                continue;
+
+              dns_cache_entry entry;
+              entry.q = ( *iter )->_question;
+              entry.records = ( *iter )->records;
+              entry.negative = ( *iter )->_negative;
+              entry.ttl = uint32_t(( ( *iter )->_expirationTime.last() - nowTime ).total_seconds());
+              out.push_back(entry);
+            }
           }
 
           /*!
+           Restores an RRset exported by entries(). The records' TTLs are set to the remaining
+           TTL, so the records must not be shared with anything else.
+
+           \param q Question the RRset answers
+           \param records The records, the SOA for a negative answer
+           \param negative Kind of negative answer
+           \param ttl Seconds of TTL left
            */
-          virtual
-          ~rr_cache ()
+          void
+          restore ( const question& q, const rr_list_t& records, const negative_t negative, const uint32_t ttl )
           {
+            boost::mutex::scoped_lock scopeLock(_mutex);
+            restore_entry(q, shared_rrset_t(new rr_list_t(records)), negative, ttl, second_clock::local_time());
           }
 
           /*!
+           Restores a batch of RRsets exported by entries(), under a single lock. The cache
+           keeps the batch's record lists instead of copying them.
+
+           While there is room, RRsets go straight into the index. They skip the doorkeeper
+           and the eviction pass, and the whole batch shares one clock reading.
+
+           \param batch RRsets to restore
+           \param remaining RRsets left to restore, this batch included, so the index is
+           sized once for the whole restore instead of growing batch by batch
            */
-          bool
-          expired () const
+          void
+          restore ( const std::vector< dns_cache_entry >& batch, const std::size_t remaining = 0 )
           {
-            if( _perm )
-              return false;
+            boost::mutex::scoped_lock scopeLock(_mutex);
 
-            ptime nowTime = second_clock::local_time();
-            return ( !_expirationTime.contains(nowTime) );
+            // grow the hash index once instead of rehashing along the way
+            std::size_t expected(_cache.size() + ( std::max )(batch.size(), remaining));
+            if( !_max_bytes )
+              expected = ( std::min )(expected, std::size_t(_max_elements));
+
+            if( expected > _cache.template get< by_q > ().bucket_count() )
+              _cache.template get< by_q > ().rehash(expected);
+
+            ptime nowTime(second_clock::local_time());
+            for( std::vector< dns_cache_entry >::const_iterator iter = batch.begin(); iter != batch.end(); ++iter )
+            {
+              if( iter->records )
+                restore_entry(iter->q, iter->records, iter->negative, iter->ttl, nowTime);
+            }
           }
 
-          uint32_t
-          hits () const
+          /*!
+           Drops every RRset at or below domain, e.g. after the zone changed. Permanent
+           RRsets stay. Without the name index this is a scan of the whole cache.
+
+           \param domain Top of the subtree to drop
+           \return Number of RRsets dropped
+           */
+          std::size_t
+          flush ( const std::string& domain )
           {
-            if( _perm )
-              return 0xFFFFFFFF;
+            boost::mutex::scoped_lock scopeLock(_mutex);
+
+            std::vector< rr_cache* > found;
+            if( _names )
+            {
+              typename name_tree_t::node* n(_names->find(domain));
+              if( n )
+                _names->subtree(n, found);
+            }
+            else
+            {
+              for( q_iter_t iter = _cache.template get< by_q > ().begin(); iter != _cache.template get< by_q > ().end(); ++iter )
+              {
+                if( in_domain(( *iter )->_question.domain(), domain) )
+                  found.push_back(iter->get());
+              }
+            }
+
+            std::size_t count(0);
+            for( typename std::vector< rr_cache* >::iterator iter = found.begin(); iter != found.end(); ++iter )
+            {
+              if( ( *iter )->_perm )
+                continue;
+
+              erase(_cache.template get< by_q > ().find(( *iter )->_qHash));
+              ++count;
+            }
 
-            return _hits;
+            _counters._flushed += count;
+            return count;
           }
 
-        };
-        /*!
-         */
-        typedef shared_ptr< rr_cache > shared_rr_cache;
+          /*!
+           Finds the cached NS RRset of the closest delegation enclosing domain, the
+           servers to ask about domain when nothing closer is known.
 
-        struct by_d
-        {
-        };
-        struct by_r
-        {
-        };
-        struct by_q
-        {
-        };
-        struct by_hits
-        {
-        };
-        struct by_ttl
-        {
-        };
-#if !defined(GENERATING_DOCUMENTATION)
-        /*!
-         */
-        typedef boost::multi_index::multi_index_container< shared_rr_cache, boost::multi_index::indexed_by<
-            boost::multi_index::hashed_non_unique< boost::multi_index::tag< by_d >, boost::multi_index::member<
-                rr_cache, std::size_t, &rr_cache::_dHash > >,
-            boost::multi_index::hashed_unique< boost::multi_index::tag< by_r >, boost::multi_index::member< rr_cache,
-                std::size_t, &rr_cache::_rHash > >, boost::multi_index::hashed_non_unique< boost::multi_index::tag<
-                by_q >, boost::multi_index::member< rr_cache, std::size_t, &rr_cache::_qHash > >,
-            boost::multi_index::ordered_non_unique< boost::multi_index::tag< by_hits >,
-                boost::multi_index::const_mem_fun< rr_cache, uint32_t, &rr_cache::hits > >,
-            boost::multi_index::ordered_non_unique< boost::multi_index::tag< by_ttl >,
-                boost::multi_index::const_mem_fun< rr_cache, bool, &rr_cache::expired > > > > rr_container_t;
-#endif
-        typedef rr_container_t::index< by_d >::type::iterator d_iter_t;
-        typedef rr_container_t::index< by_r >::type::iterator r_iter_t;
-        typedef rr_container_t::index< by_q >::type::iterator q_iter_t;
-        typedef rr_container_t::index< by_hits >::type::iterator hits_iter_t;
-        typedef rr_container_t::index< by_ttl >::type::iterator ttl_iter_t;
-
-        ///
-        rr_container_t _cache;
-        ///
-        const uint32_t _max_elements;
-        ///
-        boost::mutex _mutex;
-
-      public:
-        /*!
-         */
-        dns_cache_t () :
-          _max_elements(16)
-        {
-        }
+           \param domain Name to find the delegation for
+           \return The NS set, empty if no enclosing delegation is cached
+           */
+          shared_rrset_t
+          closest_ns ( const std::string& domain )
+          {
+            boost::mutex::scoped_lock scopeLock(_mutex);
 
-        /*!
-         */
-        bool
-        exists ( const question& q )
-        {
-          boost::mutex::scoped_lock scopeLock(_mutex);
+            if( _names )
+            {
+              for( typename name_tree_t::node* n = _names->closest(domain); n; n = n->_parent )
+              {
+                for( typename std::vector< rr_cache* >::iterator iter = n->_entries.begin(); iter
+                    != n->_entries.end(); ++iter )
+                {
+                  if( ( *iter )->_question.rtype() == type_ns && ( *iter )->_question.rclass() == class_in
+                      && ( *iter )->_negative == negative_none && !( *iter )->expired() )
+                  {
+                    _policy.touched(*( *iter ));
+                    return ( *iter )->records;
+                  }
+                }
+              }
 
-          size_t qHash = dns_hasher::query(q);
+              return shared_rrset_t();
+            }
 
-          q_iter_t rrIter = _cache.get< by_q > ().find(qHash);
-          if( rrIter == _cache.get< by_q > ().end() )
-            return false;
+            // without the index, probe every ancestor of the name
+            std::string name(domain);
+            for( std::string::iterator iter = name.begin(); iter != name.end(); ++iter )
+            {
+              if( *iter >= 'A' && *iter <= 'Z' )
+                *iter += 'a' - 'A';
+            }
 
-          return true;
-        }
+            while( true )
+            {
+              question q(name, type_ns);
+              q_iter_t iter = _cache.template get< by_q > ().find(dns_hasher::query(q));
+              if( iter != _cache.template get< by_q > ().end() && ( *iter )->matches(q) && ( *iter )->_negative
+                  == negative_none && !( *iter )->expired() )
+              {
+                _policy.touched(*( *iter ));
+                return ( *iter )->records;
+              }
 
-        /*!
-         */
-        bool
-        exists ( const std::string& domain, const type_t rType )
-        {
-          question q(domain, rType);
-          return exists(q);
-        }
+              std::string::size_type dot(name.find('.'));
+              if( name == "." || dot == std::string::npos )
+                break;
 
-        /*!
-         */
-        rr_list_t
-        get ( const question& q )
-        {
-          boost::mutex::scoped_lock scopeLock(_mutex);
+              name = ( dot + 1 < name.size() ) ? name.substr(dot + 1) : std::string(".");
+            }
+
+            return shared_rrset_t();
+          }
+
+          /*!
+           Current occupancy of the cache and the counters since it was created.
+           */
+          dns_cache_stats
+          stats ()
+          {
+            boost::mutex::scoped_lock scopeLock(_mutex);
+
+            dns_cache_stats s;
+            s.bytes = _bytes;
+            s.entries = _cache.size();
+
+            const counters& c(_counters);
+            s.hits = c._hits;
+            s.negative_hits = c._negative_hits;
+            s.stale_hits = c._stale_hits;
+            s.misses = c._misses;
+            s.inserts = c._inserts;
+            s.expirations = c._expirations;
+            s.evictions = c._evictions;
+            s.expired = c._expired;
+            s.replaced = c._replaced;
+            s.flushed = c._flushed;
+            s.rejected = c._rejected;
+
+            for( std::size_t t = 0; t < type_slots; ++t )
+            {
+              if( c._type_hits[t] || c._type_misses[t] || c._type_entries[t] )
+              {
+                dns_cache_type_stats& ts(s.types[type_t(t)]);
+                ts.hits = c._type_hits[t];
+                ts.misses = c._type_misses[t];
+                ts.entries = c._type_entries[t];
+              }
+            }
+
+            if( _filterStorage )
+            {
+              s.filtered = _filterStorage->rejections();
+              s.misses += s.filtered;
+            }
 
-          rr_list_t retList;
+            return s;
+          }
 
-          std::pair< q_iter_t, q_iter_t > rrIter = _cache.get< by_q > ().equal_range(dns_hasher::query(q));
-          while( rrIter.first != rrIter.second )
+          /*!
+           */
+          void
+          show_cache ()
           {
-            ( *rrIter.first )->_hits++;
-            ( *rrIter.first )->_timeRetrieved = second_clock::local_time();
+            boost::mutex::scoped_lock scopeLock(_mutex);
+
+            q_iter_t iter;
 
-            retList.push_back( ( *rrIter.first )->record);
-            rrIter.first++;
+            for( iter = _cache.template get< by_q > ().begin(); iter != _cache.template get< by_q > ().end(); ++iter )
+            {
+              cout << "+----+----+----+----+----+----+----+----+----+----+----+----+----+----+----+" << endl
+                  << "          Hits: " << ( *iter )->_hits << endl << "   Lifetime at: " << to_simple_string(
+                  ( *iter )->_expirationTime) << endl << "Last Retrieved: " << to_simple_string(
+                  ( *iter )->_timeRetrieved) << endl;
+              const rr_list_t& cached(*( *iter )->records);
+              for( rr_list_t::const_iterator rIter = cached.begin(); rIter != cached.end(); ++rIter )
+                debug::dump_record(cout, rIter->get());
+            }
           }
 
-          return retList;
-        }
+        private:
+          /*!
+           Counts the expiry of an RRset the first time a lookup finds it expired
+           */
+          void
+          lapsed ( rr_cache& rrItem )
+          {
+            if( rrItem._lapsed )
+              return;
 
-        /*!
-         */
-        rr_list_t
-        get ( const std::string& domain, const type_t rType )
-        {
-          question q(domain, rType);
-          return get(q);
-        }
+            rrItem._lapsed = true;
+            ++_counters._expirations;
+          }
 
-        /*!
-         */
-        void
-        add ( const shared_resource_base_t& rr, const bool perm = false )
-        {
-          if( _cache.size() > _max_elements )
-            reserve(4, *rr.get());
+          static std::size_t
+          type_slot ( const type_t t )
+          {
+            return ( std::size_t(t) < type_slots ) ? std::size_t(t) : std::size_t(type_none);
+          }
 
-          boost::mutex::scoped_lock scopeLock(_mutex);
-          shared_rr_cache rrItem(new rr_cache(rr, perm));
-          _cache.insert(rrItem);
-        }
+          /*!
+           True if name is domain or a name below it, case insensitive
+           */
+          static bool
+          in_domain ( const std::string& name, const std::string& domain )
+          {
+            std::string n(name), d(domain);
+            if( n.empty() || n[n.size() - 1] != '.' )
+              n += '.';
+            if( d.empty() || d[d.size() - 1] != '.' )
+              d += '.';
 
-        /*!
-         */
-        void
-        reserve ( const size_t reserve_count, request_base_t& q )
-        {
-          size_t cacheSize = _cache.size();
-          if( cacheSize < ( _max_elements - reserve_count ) )
-            return;
-
-          expiredCleanup(reserve_count, q);
-          cacheSize = _cache.size();
-          if( reserve_count < ( _max_elements - _cache.size() ) )
-            return;
-
-          uint32_t lowMark(0);
-          while( reserve_count > ( _max_elements - _cache.size() ) )
-            lowestHitCleanup(reserve_count, q, lowMark++);
-        }
+            if( d == "." )
+              return true;
 
-        /*!
-         */
-        void
-        show_cache ()
-        {
-          d_iter_t iter;
+            if( n.size() < d.size() )
+              return false;
+
+            std::size_t offset(n.size() - d.size());
+            if( offset && n[offset - 1] != '.' )
+              return false;
+
+            for( std::size_t i = 0; i < d.size(); ++i )
+            {
+              char a(n[offset + i]), b(d[i]);
+              if( a >= 'A' && a <= 'Z' )
+                a += 'a' - 'A';
+              if( b >= 'A' && b <= 'Z' )
+                b += 'a' - 'A';
+              if( a != b )
+                return false;
+            }
+
+            return true;
+          }
 
-          for( iter = _cache.get< by_d > ().begin(); iter != _cache.get< by_d > ().end(); ++iter )
+          void
+          restore_entry ( const question& q, shared_rrset_t records, const negative_t negative, const uint32_t ttl,
+              const ptime& nowTime )
           {
-            cout << "+----+----+----+----+----+----+----+----+----+----+----+----+----+----+----+" << endl
-                << "          Hits: " << ( *iter )->_hits << endl << "   Lifetime at: " << to_simple_string(
-                ( *iter )->_expirationTime) << endl << "Last Retrieved: " << to_simple_string(
-                ( *iter )->_timeRetrieved) << endl;
-            debug::dump_record(cout, ( *iter )->record.get());
+            if( records->empty() || !ttl )
+              return;
+
+            for( rr_list_t::const_iterator iter = records->begin(); iter != records->end(); ++iter )
+              ( *iter )->ttl(ttl);
+
+            // a negative answer holds only its SOA
+            if( negative != negative_none && records->size() > 1 )
+              records.reset(new rr_list_t(1, records->front()));
+
+            shared_rr_cache rrItem(boost::make_shared< rr_cache >(q, records, negative, nowTime, ttl));
+            rrItem->_bytes = dns_sizer::rrset(*rrItem->records) + dns_sizer::overhead();
+
+            // a restored set takes free room as is, a duplicate or a full cache goes the long way
+            if( full(1, rrItem->_bytes) || !_cache.insert(rrItem).second )
+            {
+              insert(rrItem, q);
+              return;
+            }
+
+            inserted(*rrItem);
           }
-        }
 
-      private:
-        /*!
-         */
-        int
-        expiredCleanup ( size_t reserve_count, request_base_t& q )
-        {
-          boost::mutex::scoped_lock scopeLock(_mutex);
-          int count(0);
-          std::pair< ttl_iter_t, ttl_iter_t > range_iter;
-          for( range_iter = _cache.get< by_ttl > ().equal_range(true); range_iter.first != range_iter.second; ++range_iter.first, ++count )
+          /*!
+           */
+          void
+          replace ( const question& q, const rr_list_t& rrset, const bool perm )
+          {
+            shared_rr_cache rrItem(new rr_cache(q, rrset, perm));
+            rrItem->_bytes = dns_sizer::rrset(*rrItem->records) + dns_sizer::overhead();
+
+            insert(rrItem, q);
+          }
+
+          /*!
+           Inserts an entry, replacing whatever is cached under its key. With a byte budget
+           the entry goes in only once it fits, an entry larger than the whole budget never does.
+           */
+          void
+          insert ( const shared_rr_cache& rrItem, const request_base_t& q )
           {
-            if( q.domain() != ( *range_iter.first )->record->domain() )
+            if( _max_bytes && rrItem->_bytes > _max_bytes )
             {
-              _cache.get< by_ttl > ().erase(range_iter.first);
-              if( --reserve_count == 0 )
-                break;
+              ++_counters._rejected;
+              return;
+            }
+
+            // a fill counts as a use, so names turned away by the prefilter still gain popularity
+            if( _doorkeeper && !rrItem->_perm )
+              _doorkeeper->increment(rrItem->_qHash);
+
+            const rr_cache* candidate(rrItem->_perm ? 0 : rrItem.get());
+
+            q_iter_t iter = _cache.template get< by_q > ().find(rrItem->_qHash);
+            if( iter != _cache.template get< by_q > ().end() )
+            {
+              ++_counters._replaced;
+              erase(iter);
+              candidate = 0;
+            }
+
+            // what's left may be permanent or for the same domain, and can't be evicted
+            if( !evict(1, rrItem->_bytes, q, candidate) || ( _max_bytes && full(1, rrItem->_bytes) ) )
+            {
+              ++_counters._rejected;
+              return;
             }
+
+            if( _cache.insert(rrItem).second )
+              inserted(*rrItem);
           }
 
-          return count;
-        }
+          /*!
+           Bookkeeping for an entry that just went into the index.
+           */
+          void
+          inserted ( rr_cache& rrItem )
+          {
+            counters& c(_counters);
+            ++c._inserts;
+            ++c._type_entries[type_slot(rrItem._question.rtype())];
 
-        /*!
-         */
-        uint32_t
-        lowestHitCleanup ( size_t reserve_count, request_base_t& q, uint32_t lowMark = 0 )
-        {
-          boost::mutex::scoped_lock scopeLock(_mutex);
-          int count(0);
+            _bytes += rrItem._bytes;
+            _policy.inserted(rrItem);
+            if( _names )
+              _names->insert(rrItem, rrItem._question.domain());
+            if( dns_cache_filter* filter = _filter.load(boost::memory_order_relaxed) )
+              filter->add(rrItem._qHash);
+          }
+
+          /*!
+           */
+          void
+          erase ( q_iter_t iter )
+          {
+            --_counters._type_entries[type_slot(( *iter )->_question.rtype())];
+
+            _policy.erased(*( *iter ));
+            if( _names )
+              _names->erase(*( *iter ));
+            if( dns_cache_filter* filter = _filter.load(boost::memory_order_relaxed) )
+              filter->remove(( *iter )->_qHash);
+            _bytes -= ( *iter )->_bytes;
+            _cache.template get< by_q > ().erase(iter);
+          }
+
+          /*!
+           */
+          bool
+          full ( const size_t reserve_count, const size_t reserve_bytes ) const
+          {
+            if( _max_bytes )
+              return _bytes + reserve_bytes > _max_bytes;
 
-          std::pair< hits_iter_t, hits_iter_t > range_iter;
-          for( range_iter = _cache.get< by_hits > ().equal_range(lowMark); range_iter.first != range_iter.second; ++range_iter.first, ++count )
+            return _cache.size() + reserve_count > _max_elements;
+          }
+
+          /*!
+           Asks the policy for victims until reserve_count RRsets of reserve_bytes fit.
+           Permanent RRsets and RRsets for the domain of q are passed back to the policy
+           as touched.
+
+           \param candidate RRset the room is for, checked by the doorkeeper against the
+           first victim. 0 to admit unconditionally.
+           \return false when the doorkeeper turned candidate away, nothing is evicted then
+           */
+          bool
+          evict ( const size_t reserve_count, const size_t reserve_bytes, const request_base_t& q,
+              const rr_cache* candidate = 0 )
           {
-            if( q.domain() != ( *range_iter.first )->record->domain() )
+            size_t count(0);
+            size_t attempts(_cache.size());
+
+            while( full(reserve_count, reserve_bytes) && attempts-- )
             {
-              _cache.get< by_hits > ().erase(range_iter.first);
-              if( --reserve_count == 0 )
+              rr_cache* victim = _policy.victim();
+              if( !victim )
                 break;
+
+              if( victim->_perm || q.domain() == victim->_question.domain() )
+              {
+                _policy.touched(*victim);
+                continue;
+              }
+
+              if( candidate && _doorkeeper && !count
+                  && _doorkeeper->estimate(candidate->_qHash) <= _doorkeeper->estimate(victim->_qHash) )
+                return false;
+
+              erase(_cache.template get< by_q > ().find(victim->_qHash));
+              ++count;
             }
+
+            _counters._evictions += count;
+            return true;
           }
+        };
 
-          return count;
-        }
-      };
+#if !defined(GENERATING_DOCUMENTATION)
+      typedef basic_dns_cache< > dns_cache_t;
+#endif
 
     } // namespace dns
   } // namespace net
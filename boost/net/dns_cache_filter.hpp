@@ -0,0 +1,171 @@
+/*
+ dns_cache_filter.hpp
+ ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+ Copyright (c) 2008 - 2012 Andreas Haberstroh
+ (andreas at ibusy dot com)
+ (softwareace01 at google dot com)
+ (softwareace at yahoo dot com)
+
+ Distributed under the Boost Software License, Version 1.0. (See accompanying
+ file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+
+#ifndef BOOST_NET_DNS_CACHE_FILTER_HPP
+#define BOOST_NET_DNS_CACHE_FILTER_HPP
+
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/thread/thread.hpp>
+
+namespace boost
+{
+  namespace net
+  {
+    namespace dns
+    {
+
+      /*!
+       Counting Bloom filter over the keys held by a cache, used to turn away lookups
+       for keys that are definitely not cached without taking the cache lock.
+
+       Every key sets 'hashes' 8 bit counters. add() and remove() must be serialized by
+       the caller, may_contain() can run at any time from any thread. A counter that
+       reaches its maximum stays there, which can only cause false positives.
+
+       With 8 counters per key a lookup for an uncached key gets through about 3% of
+       the time.
+       */
+      class dns_cache_filter
+      {
+      private:
+        enum
+        {
+          hashes = 3, max_count = 255, counter_slots = 16
+        };
+
+        struct rejected_counter
+        {
+          boost::atomic< std::size_t > _count;
+          char _padding[64];
+        };
+
+        std::size_t _mask;
+        scoped_array< boost::atomic< boost::uint8_t > > _counters;
+
+        /// Lookups turned away, counted outside any lock so spread over slots by thread
+        rejected_counter _rejected[counter_slots];
+
+        dns_cache_filter ( const dns_cache_filter& );
+        dns_cache_filter&
+        operator= ( const dns_cache_filter& );
+
+      public:
+        /*!
+         \param capacity Number of keys the filter is sized for
+         */
+        explicit
+        dns_cache_filter ( const std::size_t capacity ) :
+          _mask(0), _counters()
+        {
+          std::size_t width(64);
+          while( width < 8 * capacity )
+            width <<= 1;
+
+          _mask = width - 1;
+          _counters.reset(new boost::atomic< boost::uint8_t >[width]);
+          clear();
+
+          for( std::size_t i = 0; i < counter_slots; ++i )
+            _rejected[i]._count.store(0, boost::memory_order_relaxed);
+        }
+
+        void
+        add ( const std::size_t key )
+        {
+          for( std::size_t i = 0; i < hashes; ++i )
+          {
+            boost::atomic< boost::uint8_t >& counter(_counters[index(key, i)]);
+            boost::uint8_t count(counter.load(boost::memory_order_relaxed));
+            if( count < max_count )
+              counter.store(count + 1, boost::memory_order_release);
+          }
+        }
+
+        void
+        remove ( const std::size_t key )
+        {
+          for( std::size_t i = 0; i < hashes; ++i )
+          {
+            boost::atomic< boost::uint8_t >& counter(_counters[index(key, i)]);
+            boost::uint8_t count(counter.load(boost::memory_order_relaxed));
+            if( count && count < max_count )
+              counter.store(count - 1, boost::memory_order_release);
+          }
+        }
+
+        /*!
+         False when key is definitely not in the filter
+         */
+        bool
+        may_contain ( const std::size_t key ) const
+        {
+          for( std::size_t i = 0; i < hashes; ++i )
+          {
+            if( !_counters[index(key, i)].load(boost::memory_order_acquire) )
+              return false;
+          }
+
+          return true;
+        }
+
+        void
+        clear ()
+        {
+          for( std::size_t i = 0; i <= _mask; ++i )
+            _counters[i].store(0, boost::memory_order_relaxed);
+        }
+
+        /// Counts a lookup the filter turned away
+        void
+        rejected ()
+        {
+          std::size_t slot(boost::hash< boost::thread::id >()(boost::this_thread::get_id()) % counter_slots);
+          _rejected[slot]._count.fetch_add(1, boost::memory_order_relaxed);
+        }
+
+        /// Lookups the filter turned away
+        std::size_t
+        rejections () const
+        {
+          std::size_t count(0);
+          for( std::size_t i = 0; i < counter_slots; ++i )
+            count += _rejected[i]._count.load(boost::memory_order_relaxed);
+
+          return count;
+        }
+
+      private:
+        std::size_t
+        index ( const std::size_t key, const std::size_t row ) const
+        {
+          static const boost::uint64_t seeds[hashes] =
+          { 0xc3a5c85c97cb3127ULL, 0xb492b66fbe98f273ULL, 0x9ae16a3b2f90404fULL };
+
+          boost::uint64_t h = boost::uint64_t(key) ^ seeds[row];
+          h ^= h >> 33;
+          h *= 0xff51afd7ed558ccdULL;
+          h ^= h >> 33;
+          h *= 0xc4ceb9fe1a85ec53ULL;
+          h ^= h >> 33;
+          return std::size_t(h) & _mask;
+        }
+      };
+
+    } // namespace dns
+  } // namespace net
+} // namespace boost
+
+#endif  // BOOST_NET_DNS_CACHE_FILTER_HPP
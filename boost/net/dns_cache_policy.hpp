@@ -0,0 +1,427 @@
+/*
+ dns_cache_policy.hpp
+ ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+ Copyright (c) 2008 - 2012 Andreas Haberstroh
+ (andreas at ibusy dot com)
+ (softwareace01 at google dot com)
+ (softwareace at yahoo dot com)
+
+ Distributed under the Boost Software License, Version 1.0. (See accompanying
+ file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+
+#ifndef BOOST_NET_DNS_CACHE_POLICY_HPP
+#define BOOST_NET_DNS_CACHE_POLICY_HPP
+
+#include <list>
+#include <vector>
+#include <algorithm>
+#include <boost/cstdint.hpp>
+
+namespace boost
+{
+  namespace net
+  {
+    namespace dns
+    {
+
+      /*!
+       Eviction policies for the basic_dns_cache.
+
+       A policy is a class template over the cache entry type and must provide:
+
+       hook_type - per entry bookkeeping, stored in the entry as _policy_hook
+       policy(capacity) - constructs the policy for a cache of 'capacity' entries
+       record(key) - called for every lookup, hit or miss
+       inserted(entry), touched(entry), erased(entry) - entry life cycle notifications
+       victim() - returns the next entry to evict, or 0 if there is none
+
+       Every operation is O(1), victim() is amortized O(1) for the CLOCK policy.
+       */
+
+      /*!
+       Least recently used eviction.
+       */
+      template<typename Entry>
+        class lru_policy
+        {
+        private:
+          typedef std::list< Entry* > list_t;
+
+          /// Most recently used entries are at the front
+          list_t _list;
+
+        public:
+          struct hook_type
+          {
+            typename list_t::iterator _pos;
+          };
+
+          explicit
+          lru_policy ( const std::size_t )
+          {
+          }
+
+          void
+          record ( const std::size_t )
+          {
+          }
+
+          void
+          inserted ( Entry& e )
+          {
+            e._policy_hook._pos = _list.insert(_list.begin(), &e);
+          }
+
+          void
+          touched ( Entry& e )
+          {
+            _list.splice(_list.begin(), _list, e._policy_hook._pos);
+          }
+
+          void
+          erased ( Entry& e )
+          {
+            _list.erase(e._policy_hook._pos);
+          }
+
+          Entry*
+          victim ()
+          {
+            if( _list.empty() )
+              return 0;
+
+            return _list.back();
+          }
+        };
+
+      /*!
+       CLOCK (second chance) eviction.
+
+       Hits only set a reference bit, so a hit never reorders anything.
+       */
+      template<typename Entry>
+        class clock_policy
+        {
+        private:
+          /// Circular buffer of entries, empty slots are 0
+          std::vector< Entry* > _ring;
+
+          /// Empty slots in the ring
+          std::vector< std::size_t > _free;
+
+          /// Position of the clock hand
+          std::size_t _hand;
+
+        public:
+          struct hook_type
+          {
+            std::size_t _slot;
+            bool _referenced;
+          };
+
+          explicit
+          clock_policy ( const std::size_t capacity ) :
+            _ring(), _free(), _hand(0)
+          {
+            _ring.reserve(capacity + 1);
+          }
+
+          void
+          record ( const std::size_t )
+          {
+          }
+
+          void
+          inserted ( Entry& e )
+          {
+            std::size_t slot;
+            if( _free.empty() )
+            {
+              slot = _ring.size();
+              _ring.push_back(&e);
+            }
+            else
+            {
+              slot = _free.back();
+              _free.pop_back();
+              _ring[slot] = &e;
+            }
+
+            e._policy_hook._slot = slot;
+            e._policy_hook._referenced = false;
+          }
+
+          void
+          touched ( Entry& e )
+          {
+            e._policy_hook._referenced = true;
+          }
+
+          void
+          erased ( Entry& e )
+          {
+            _ring[e._policy_hook._slot] = 0;
+            _free.push_back(e._policy_hook._slot);
+          }
+
+          Entry*
+          victim ()
+          {
+            // two sweeps clear every reference bit, so this always finds a victim
+            for( std::size_t n = 0; n < 2 * _ring.size(); ++n )
+            {
+              if( _hand >= _ring.size() )
+                _hand = 0;
+
+              Entry* e = _ring[_hand++];
+              if( !e )
+                continue;
+
+              if( e->_policy_hook._referenced )
+              {
+                e->_policy_hook._referenced = false;
+                continue;
+              }
+
+              return e;
+            }
+
+            return 0;
+          }
+        };
+
+      /*!
+       Approximate access frequency counter, a count-min sketch with 4 rows of
+       saturating 4 bit counters. All counters are halved once the sample count
+       reaches ten times the capacity, so old popularity fades away.
+       */
+      class frequency_sketch
+      {
+      private:
+        enum
+        {
+          depth = 4, max_count = 15
+        };
+
+        std::size_t _mask;
+        std::vector< uint8_t > _table;
+        std::size_t _samples;
+        std::size_t _sample_limit;
+
+      public:
+        explicit
+        frequency_sketch ( const std::size_t capacity ) :
+          _mask(0), _table(), _samples(0), _sample_limit(10 * ( std::max )(capacity, std::size_t(1)))
+        {
+          std::size_t width(16);
+          while( width < capacity )
+            width <<= 1;
+
+          _mask = width - 1;
+          _table.assign(width * depth, 0);
+        }
+
+        void
+        increment ( const std::size_t key )
+        {
+          bool added(false);
+          for( std::size_t i = 0; i < depth; ++i )
+          {
+            uint8_t& counter = _table[i * ( _mask + 1 ) + index(key, i)];
+            if( counter < max_count )
+            {
+              ++counter;
+              added = true;
+            }
+          }
+
+          if( added && ++_samples >= _sample_limit )
+            reset();
+        }
+
+        uint8_t
+        estimate ( const std::size_t key ) const
+        {
+          uint8_t count(max_count);
+          for( std::size_t i = 0; i < depth; ++i )
+            count = ( std::min )(count, _table[i * ( _mask + 1 ) + index(key, i)]);
+
+          return count;
+        }
+
+      private:
+        std::size_t
+        index ( const std::size_t key, const std::size_t row ) const
+        {
+          static const boost::uint64_t seeds[depth] =
+          { 0xc3a5c85c97cb3127ULL, 0xb492b66fbe98f273ULL, 0x9ae16a3b2f90404fULL, 0xcbf29ce484222325ULL };
+
+          boost::uint64_t h = ( boost::uint64_t(key) + seeds[row] ) * 0x9e3779b97f4a7c15ULL;
+          h ^= h >> 32;
+          return std::size_t(h) & _mask;
+        }
+
+        void
+        reset ()
+        {
+          for( std::vector< uint8_t >::iterator iter = _table.begin(); iter != _table.end(); ++iter )
+            *iter >>= 1;
+
+          _samples /= 2;
+        }
+      };
+
+      /*!
+       W-TinyLFU eviction.
+
+       New entries land in a small LRU window (1% of the capacity). Entries that
+       fall out of the window move into the probation segment of a segmented LRU,
+       and a second hit there promotes them into the protected segment (80% of the
+       main space). When room is needed, the newest entry from the window has to
+       beat the probation victim on estimated frequency, otherwise it is evicted
+       itself. A burst of one-off names therefore can't flush the working set.
+
+       Entry must provide policy_key(), the key passed to record() on lookups.
+       */
+      template<typename Entry>
+        class tinylfu_policy
+        {
+        private:
+          typedef std::list< Entry* > list_t;
+
+          enum segment_t
+          {
+            seg_window, seg_probation, seg_protected
+          };
+
+          list_t _window;
+          list_t _probation;
+          list_t _protected;
+
+          std::size_t _window_max;
+          std::size_t _protected_max;
+
+          frequency_sketch _sketch;
+
+        public:
+          struct hook_type
+          {
+            typename list_t::iterator _pos;
+            segment_t _segment;
+
+            /// Moved out of the window and hasn't been compared against a victim yet
+            bool _candidate;
+          };
+
+          explicit
+          tinylfu_policy ( const std::size_t capacity ) :
+            _window(), _probation(), _protected(), _window_max(( std::max )(capacity / 100, std::size_t(1))),
+                _protected_max(( capacity - ( std::min )(capacity, _window_max) ) * 4 / 5), _sketch(capacity)
+          {
+          }
+
+          void
+          record ( const std::size_t key )
+          {
+            _sketch.increment(key);
+          }
+
+          void
+          inserted ( Entry& e )
+          {
+            e._policy_hook._pos = _window.insert(_window.begin(), &e);
+            e._policy_hook._segment = seg_window;
+            e._policy_hook._candidate = false;
+
+            if( _window.size() > _window_max )
+            {
+              Entry* demoted = _window.back();
+              move(*demoted, _probation, seg_probation);
+              demoted->_policy_hook._candidate = true;
+            }
+          }
+
+          void
+          touched ( Entry& e )
+          {
+            switch( e._policy_hook._segment )
+            {
+            case seg_window:
+              _window.splice(_window.begin(), _window, e._policy_hook._pos);
+              break;
+
+            case seg_probation:
+              move(e, _protected, seg_protected);
+              e._policy_hook._candidate = false;
+              if( _protected.size() > _protected_max )
+                move(*_protected.back(), _probation, seg_probation);
+              break;
+
+            case seg_protected:
+              _protected.splice(_protected.begin(), _protected, e._policy_hook._pos);
+              break;
+            }
+          }
+
+          void
+          erased ( Entry& e )
+          {
+            segment(e._policy_hook._segment).erase(e._policy_hook._pos);
+          }
+
+          Entry*
+          victim ()
+          {
+            Entry* victim(0);
+            if( !_probation.empty() )
+              victim = _probation.back();
+            else if( !_protected.empty() )
+              victim = _protected.back();
+            else if( !_window.empty() )
+              return _window.back();
+            else
+              return 0;
+
+            Entry* candidate(_probation.empty() ? 0 : _probation.front());
+            if( candidate && candidate != victim && candidate->_policy_hook._candidate )
+            {
+              candidate->_policy_hook._candidate = false;
+              if( _sketch.estimate(candidate->policy_key()) <= _sketch.estimate(victim->policy_key()) )
+                return candidate;
+            }
+
+            return victim;
+          }
+
+        private:
+          list_t&
+          segment ( const segment_t s )
+          {
+            switch( s )
+            {
+            case seg_window:
+              return _window;
+            case seg_probation:
+              return _probation;
+            case seg_protected:
+              break;
+            }
+
+            return _protected;
+          }
+
+          void
+          move ( Entry& e, list_t& to, const segment_t s )
+          {
+            to.splice(to.begin(), segment(e._policy_hook._segment), e._policy_hook._pos);
+            e._policy_hook._segment = s;
+          }
+        };
+
+    } // namespace dns
+  } // namespace net
+} // namespace boost
+
+#endif  // BOOST_NET_DNS_CACHE_POLICY_HPP
@@ -0,0 +1,375 @@
+/*
+ dns_cache_snapshot.hpp
+ ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+ Copyright (c) 2008 - 2012 Andreas Haberstroh
+ (andreas at ibusy dot com)
+ (softwareace01 at google dot com)
+ (softwareace at yahoo dot com)
+
+ Distributed under the Boost Software License, Version 1.0. (See accompanying
+ file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+
+#ifndef BOOST_NET_DNS_CACHE_SNAPSHOT_HPP
+#define BOOST_NET_DNS_CACHE_SNAPSHOT_HPP
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/net/dns.hpp>
+#include <boost/net/dns_cache.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+namespace boost
+{
+  namespace net
+  {
+    namespace dns
+    {
+
+      /*!
+       Cache snapshots for warm restarts.
+
+       A snapshot file is a header followed by one record per RRset:
+
+       header - "BDNS", version (uint32_t), time of the snapshot in seconds since
+       the epoch (uint64_t), RRset count (uint32_t)
+
+       RRset - seconds of TTL left at snapshot time (uint32_t), message length
+       (uint16_t), the RRset encoded as a DNS response message. The records of an
+       RRset are in the answer section, a negative answer carries its SOA in the
+       authority section and NXDOMAIN as the result code.
+
+       Header and lengths are in host byte order, a snapshot is not meant to move
+       between machines. Loading maps the file into memory and skips every RRset
+       whose TTL ran out while the cache was down.
+       */
+      class dns_cache_snapshot_format
+      {
+      public:
+        enum
+        {
+          version = 1
+        };
+
+        /*!
+         Upper bound of the uncompressed wire size of a record
+         */
+        static std::size_t
+        wire_size ( const shared_resource_base_t& rr )
+        {
+          // owner name, type, class, ttl and rdata length
+          std::size_t bytes(rr->domain().size() + 2 + 10);
+
+          switch( rr->rtype() )
+          {
+          case type_a:
+            return bytes + 4;
+          case type_ns:
+            return bytes + ( (ns_resource*) rr.get() )->nameserver().size() + 2;
+          case type_cname:
+            return bytes + ( (cname_resource*) rr.get() )->canonicalname().size() + 2;
+          case type_soa:
+            return bytes + ( (soa_resource*) rr.get() )->master_name().size()
+                + ( (soa_resource*) rr.get() )->responsible_name().size() + 4 + 20;
+          case type_ptr:
+            return bytes + ( (ptr_resource*) rr.get() )->pointer().size() + 2;
+          case type_hinfo:
+            return bytes + ( (hinfo_resource*) rr.get() )->cpu().size() + ( (hinfo_resource*) rr.get() )->os().size()
+                + 2;
+          case type_mx:
+            return bytes + 2 + ( (mx_resource*) rr.get() )->exchange().size() + 2;
+          case type_txt:
+            return bytes + ( (txt_resource*) rr.get() )->text().size() + ( (txt_resource*) rr.get() )->text().size()
+                / 255 + 1;
+          case type_a6:
+            return bytes + 16;
+          case type_srv:
+            return bytes + 6 + ( (srv_resource*) rr.get() )->targethost().size() + 2;
+
+          default:
+            break;
+          }
+
+          return bytes + rr->length();
+        }
+
+        /*!
+         Encodes an RRset into buffer, returns false if it doesn't fit into a dns_buffer_t.
+         */
+        static bool
+        encode ( const dns_cache_entry& entry, dns_buffer_t& buffer )
+        {
+          std::size_t bytes(12 + entry.q.domain().size() + 2 + 4);
+          for( rr_list_t::const_iterator iter = entry.records->begin(); iter != entry.records->end(); ++iter )
+            bytes += wire_size( ( *iter ));
+
+          if( bytes > buffer.get_array().size() )
+            return false;
+
+          message msg(entry.q);
+          msg.action(message::response);
+          msg.result(( entry.negative == negative_nxdomain ) ? message::name_error : message::noerror);
+
+          rr_list_t* section = ( entry.negative == negative_none ) ? msg.answers() : msg.authorites();
+          section->assign(entry.records->begin(), entry.records->end());
+
+          buffer.length(0);
+          msg.encode(buffer);
+          return true;
+        }
+
+        static boost::uint64_t
+        now ()
+        {
+          return ( posix_time::second_clock::universal_time() - posix_time::ptime(gregorian::date(1970, 1, 1)) ).total_seconds();
+        }
+      };
+
+      /*!
+       Writes every live RRset of the cache to a snapshot file. The file is written under a
+       temporary name and renamed into place, so a crash never leaves a torn snapshot.
+
+       \param cache Cache to save
+       \param path Snapshot file
+       \return Number of RRsets written, RRsets too large for a message are skipped
+       */
+      template<typename Cache>
+        std::size_t
+        save_cache ( Cache& cache, const std::string& path )
+        {
+          std::vector< dns_cache_entry > entries;
+          cache.entries(entries);
+
+          std::string tmpPath(path + ".tmp");
+          std::ofstream out(tmpPath.c_str(), std::ios::binary | std::ios::trunc);
+          if( !out )
+            return 0;
+
+          const uint32_t version(dns_cache_snapshot_format::version);
+          const boost::uint64_t snapTime(dns_cache_snapshot_format::now());
+          uint32_t count(0);
+
+          out.write("BDNS", 4);
+          out.write((const char*) &version, sizeof ( version ));
+          out.write((const char*) &snapTime, sizeof ( snapTime ));
+          std::streampos countPos(out.tellp());
+          out.write((const char*) &count, sizeof ( count ));
+
+          dns_buffer_t buffer;
+          for( std::vector< dns_cache_entry >::iterator iter = entries.begin(); iter != entries.end(); ++iter )
+          {
+            if( !dns_cache_snapshot_format::encode(*iter, buffer) )
+              continue;
+
+            uint16_t length((uint16_t) buffer.length());
+            out.write((const char*) &iter->ttl, sizeof ( iter->ttl ));
+            out.write((const char*) &length, sizeof ( length ));
+            out.write((const char*) buffer.get_array().data(), length);
+            ++count;
+          }
+
+          out.seekp(countPos);
+          out.write((const char*) &count, sizeof ( count ));
+          out.close();
+
+          if( !out || std::rename(tmpPath.c_str(), path.c_str()) != 0 )
+          {
+            std::remove(tmpPath.c_str());
+            return 0;
+          }
+
+          return count;
+        }
+
+      /*!
+       Loads a snapshot file into the cache. RRsets that expired since the snapshot was
+       taken are skipped, the others come back with the TTL they have left.
+
+       \param cache Cache to load into
+       \param path Snapshot file
+       \return Number of RRsets loaded
+       */
+      template<typename Cache>
+        std::size_t
+        load_cache ( Cache& cache, const std::string& path )
+        {
+          using namespace boost::interprocess;
+
+          std::size_t loaded(0);
+          try
+          {
+            file_mapping file(path.c_str(), read_only);
+            mapped_region region(file, read_only);
+
+            const char* pos = (const char*) region.get_address();
+            const char* end = pos + region.get_size();
+
+            const std::size_t headerSize(4 + sizeof(uint32_t) + sizeof(boost::uint64_t) + sizeof(uint32_t));
+            if( region.get_size() < headerSize || std::memcmp(pos, "BDNS", 4) != 0 )
+              return 0;
+
+            uint32_t version;
+            boost::uint64_t snapTime;
+            uint32_t count;
+            std::memcpy(&version, pos + 4, sizeof ( version ));
+            std::memcpy(&snapTime, pos + 8, sizeof ( snapTime ));
+            std::memcpy(&count, pos + 16, sizeof ( count ));
+            pos += headerSize;
+
+            if( version != dns_cache_snapshot_format::version )
+              return 0;
+
+            // seconds the cache was down, every TTL lost that much
+            boost::uint64_t nowTime(dns_cache_snapshot_format::now());
+            boost::uint64_t elapsed(( nowTime > snapTime ) ? nowTime - snapTime : 0);
+
+            // RRsets go into the cache in batches, one lock per batch
+            const std::size_t batchSize(4096);
+            std::vector< dns_cache_entry > batch;
+            batch.reserve(batchSize);
+
+            dns_buffer_t buffer;
+            message msg;
+            for( uint32_t i = 0; i < count; ++i )
+            {
+              uint32_t ttl;
+              uint16_t length;
+              if( end - pos < std::ptrdiff_t(sizeof ( ttl ) + sizeof ( length )) )
+                break;
+
+              std::memcpy(&ttl, pos, sizeof ( ttl ));
+              std::memcpy(&length, pos + sizeof ( ttl ), sizeof ( length ));
+              pos += sizeof ( ttl ) + sizeof ( length );
+
+              if( end - pos < length || length > buffer.get_array().size() )
+                break;
+
+              const char* data(pos);
+              pos += length;
+
+              if( ttl <= elapsed )
+                continue;
+
+              std::memcpy(buffer.get_array().data(), data, length);
+              buffer.length(length);
+              msg.decode(buffer);
+
+              if( msg.questions()->empty() )
+                continue;
+
+              // filled in place, copying an entry copies its name
+              batch.push_back(dns_cache_entry());
+              dns_cache_entry& entry(batch.back());
+              entry.q = msg.questions()->front();
+              entry.negative = negative_none;
+              entry.ttl = uint32_t(ttl - elapsed);
+
+              rr_list_t* records(msg.answers());
+              if( msg.result() == message::name_error || records->empty() )
+              {
+                entry.negative = ( msg.result() == message::name_error ) ? negative_nxdomain : negative_nodata;
+                records = msg.authorites();
+              }
+
+              // the cache keeps the list, take the records out of the message instead of copying
+              boost::shared_ptr< rr_list_t > restored(boost::make_shared< rr_list_t >());
+              restored->swap(*records);
+              entry.records = restored;
+
+              if( batch.size() == batchSize )
+              {
+                // the rest of the snapshot, for sizing the index up front
+                cache.restore(batch, batch.size() + count - i - 1);
+                loaded += batch.size();
+                batch.clear();
+              }
+            }
+
+            cache.restore(batch);
+            loaded += batch.size();
+          }
+          catch( std::exception& )
+          {
+            // a missing or damaged snapshot only means a cold start
+          }
+
+          return loaded;
+        }
+
+      /*!
+       Saves a cache to a snapshot file at a fixed interval, and once more when stopped.
+       */
+      template<typename Cache>
+        class dns_cache_snapshot
+        {
+        public:
+          /*!
+           \param ios io_service that runs the snapshot timer
+           \param cache Cache to save
+           \param path Snapshot file
+           \param interval Time between snapshots
+           */
+          dns_cache_snapshot (
+              io_service& ios,
+              Cache& cache,
+              const std::string& path,
+              const posix_time::time_duration& interval ) :
+            _timer(ios), _cache(cache), _path(path), _interval(interval)
+          {
+          }
+
+          /// Loads the snapshot file, if there is one, and starts saving periodically
+          std::size_t
+          start ()
+          {
+            std::size_t loaded = load_cache(_cache, _path);
+            schedule();
+            return loaded;
+          }
+
+          /// Stops the periodic saves and writes a final snapshot
+          std::size_t
+          stop ()
+          {
+            _timer.cancel();
+            return save_cache(_cache, _path);
+          }
+
+        private:
+          void
+          schedule ()
+          {
+            _timer.expires_from_now(_interval);
+            _timer.async_wait(boost::bind(&dns_cache_snapshot::handle_timer, this, boost::asio::placeholders::error));
+          }
+
+          void
+          handle_timer ( const boost::system::error_code& ec )
+          {
+            if( ec )
+              return;
+
+            save_cache(_cache, _path);
+            schedule();
+          }
+
+          deadline_timer _timer;
+          Cache& _cache;
+          std::string _path;
+          posix_time::time_duration _interval;
+        };
+
+    } // namespace dns
+  } // namespace net
+} // namespace boost
+
+#endif  // BOOST_NET_DNS_CACHE_SNAPSHOT_HPP
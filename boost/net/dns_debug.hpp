@@ -105,6 +105,9 @@ namespace boost
           case dns::type_srv:
             return "SRV";
 
+          case dns::type_opt:
+            return "OPT";
+
           case dns::type_axfr:
             return "AXFR";
 
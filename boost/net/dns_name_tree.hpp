@@ -0,0 +1,230 @@
+/*
+ dns_name_tree.hpp
+ ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+ Copyright (c) 2008 - 2012 Andreas Haberstroh
+ (andreas at ibusy dot com)
+ (softwareace01 at google dot com)
+ (softwareace at yahoo dot com)
+
+ Distributed under the Boost Software License, Version 1.0. (See accompanying
+ file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+
+#ifndef BOOST_NET_DNS_NAME_TREE_HPP
+#define BOOST_NET_DNS_NAME_TREE_HPP
+
+#include <map>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+namespace boost
+{
+  namespace net
+  {
+    namespace dns
+    {
+
+      /*!
+       Index of entries by owner name, a tree of labels read right to left.
+
+       "www.example.com." lives under "com" -> "example" -> "www", so every name
+       under a domain is in the subtree of the domain's node. Finding the node of a
+       name, or its closest existing ancestor, costs one map lookup per label.
+       Nodes without entries and children are pruned as entries are erased.
+
+       Entry must have a member _name_hook of type hook_type. Labels are compared
+       case insensitive.
+       */
+      template<typename Entry>
+        class dns_name_tree
+        {
+        public:
+          struct node
+          {
+            typedef std::map< std::string, node* > children_t;
+
+            node* _parent;
+            std::string _label;
+            children_t _children;
+            std::vector< Entry* > _entries;
+
+            node ( node* parent, const std::string& label ) :
+              _parent(parent), _label(label), _children(), _entries()
+            {
+            }
+
+            ~node ()
+            {
+              for( typename children_t::iterator iter = _children.begin(); iter != _children.end(); ++iter )
+                delete iter->second;
+            }
+          };
+
+          struct hook_type
+          {
+            node* _node;
+
+            hook_type () :
+              _node(0)
+            {
+            }
+          };
+
+        private:
+          node _root;
+
+          dns_name_tree ( const dns_name_tree& );
+          dns_name_tree&
+          operator= ( const dns_name_tree& );
+
+        public:
+          dns_name_tree () :
+            _root(0, std::string())
+          {
+          }
+
+          /*!
+           Indexes an entry under its owner name
+           */
+          void
+          insert ( Entry& e, const std::string& domain )
+          {
+            std::vector< std::string > labels;
+            split(domain, labels);
+
+            node* n(&_root);
+            for( std::vector< std::string >::reverse_iterator iter = labels.rbegin(); iter != labels.rend(); ++iter )
+            {
+              typename node::children_t::iterator child = n->_children.find(*iter);
+              if( child == n->_children.end() )
+                child = n->_children.insert(std::make_pair(*iter, new node(n, *iter))).first;
+
+              n = child->second;
+            }
+
+            n->_entries.push_back(&e);
+            e._name_hook._node = n;
+          }
+
+          /*!
+           Removes an entry, and the nodes it leaves empty
+           */
+          void
+          erase ( Entry& e )
+          {
+            node* n(e._name_hook._node);
+            if( !n )
+              return;
+
+            e._name_hook._node = 0;
+            n->_entries.erase(std::remove(n->_entries.begin(), n->_entries.end(), &e), n->_entries.end());
+
+            while( n != &_root && n->_entries.empty() && n->_children.empty() )
+            {
+              node* parent(n->_parent);
+              parent->_children.erase(n->_label);
+              delete n;
+              n = parent;
+            }
+          }
+
+          /*!
+           The node of domain, or of its closest ancestor in the tree. The root if
+           nothing of the name is indexed.
+           */
+          node*
+          closest ( const std::string& domain )
+          {
+            return walk(domain, false);
+          }
+
+          /*!
+           The node of domain, 0 if it isn't in the tree
+           */
+          node*
+          find ( const std::string& domain )
+          {
+            return walk(domain, true);
+          }
+
+          /*!
+           Every entry at or below n
+           */
+          void
+          subtree ( node* n, std::vector< Entry* >& entries ) const
+          {
+            std::vector< node* > pending(1, n);
+            while( !pending.empty() )
+            {
+              node* p(pending.back());
+              pending.pop_back();
+
+              entries.insert(entries.end(), p->_entries.begin(), p->_entries.end());
+              for( typename node::children_t::iterator iter = p->_children.begin(); iter != p->_children.end(); ++iter )
+                pending.push_back(iter->second);
+            }
+          }
+
+          bool
+          root ( const node* n ) const
+          {
+            return n == &_root;
+          }
+
+        private:
+          node*
+          walk ( const std::string& domain, const bool exact )
+          {
+            std::vector< std::string > labels;
+            split(domain, labels);
+
+            node* n(&_root);
+            for( std::vector< std::string >::reverse_iterator iter = labels.rbegin(); iter != labels.rend(); ++iter )
+            {
+              typename node::children_t::iterator child = n->_children.find(*iter);
+              if( child == n->_children.end() )
+                return exact ? 0 : n;
+
+              n = child->second;
+            }
+
+            return n;
+          }
+
+          /*!
+           Splits a domain into lower case labels, left to right. The root domain has none.
+           */
+          static void
+          split ( const std::string& domain, std::vector< std::string >& labels )
+          {
+            std::string::size_type begin(0);
+            while( begin < domain.size() )
+            {
+              std::string::size_type end(domain.find('.', begin));
+              if( end == std::string::npos )
+                end = domain.size();
+
+              if( end > begin )
+              {
+                std::string label(domain, begin, end - begin);
+                for( std::string::iterator iter = label.begin(); iter != label.end(); ++iter )
+                {
+                  if( *iter >= 'A' && *iter <= 'Z' )
+                    *iter += 'a' - 'A';
+                }
+
+                labels.push_back(label);
+              }
+
+              begin = end + 1;
+            }
+          }
+        };
+
+    } // namespace dns
+  } // namespace net
+} // namespace boost
+
+#endif  // BOOST_NET_DNS_NAME_TREE_HPP
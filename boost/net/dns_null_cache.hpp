@@ -0,0 +1,121 @@
+/*
+ dns_null_cache.hpp
+ ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+ Copyright (c) 2008 - 2012 Andreas Haberstroh
+ (andreas at ibusy dot com)
+ (softwareace01 at google dot com)
+ (softwareace at yahoo dot com)
+
+ Distributed under the Boost Software License, Version 1.0. (See accompanying
+ file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+
+#ifndef BOOST_NET_DNS_NULL_CACHE_HPP
+#define BOOST_NET_DNS_NULL_CACHE_HPP
+
+#include <boost/net/dns.hpp>
+#include <boost/net/dns_cache.hpp>
+
+namespace boost
+{
+  namespace net
+  {
+    namespace dns
+    {
+
+      /*!
+       A cache that holds nothing. Every lookup misses and every add is dropped, all
+       inline and empty, so a resolver built on it compiles its cache path away and
+       sends every question upstream.
+       */
+      class dns_null_cache
+      {
+      public:
+        void
+        serve_stale ( const time_duration& )
+        {
+        }
+
+        bool
+        serves_stale ( ) const
+        {
+          return false;
+        }
+
+        void
+        prefetch_done ( const question& )
+        {
+        }
+
+        bool
+        exists ( const question& )
+        {
+          return false;
+        }
+
+        rr_list_t
+        get ( const question& )
+        {
+          return rr_list_t();
+        }
+
+        shared_rrset_t
+        lookup ( const question&, negative_t& negative )
+        {
+          negative = negative_none;
+          return shared_rrset_t();
+        }
+
+        shared_rrset_t
+        lookup ( const question&, negative_t& negative, bool& refresh )
+        {
+          negative = negative_none;
+          refresh = false;
+          return shared_rrset_t();
+        }
+
+        shared_rrset_t
+        lookup_stale ( const question&, negative_t& negative )
+        {
+          negative = negative_none;
+          return shared_rrset_t();
+        }
+
+        void
+        stale_served ( )
+        {
+        }
+
+        void
+        add ( const shared_resource_base_t&, const bool = false )
+        {
+        }
+
+        void
+        add ( const rr_list_t&, const bool = false )
+        {
+        }
+
+        void
+        add_negative ( const question&, const shared_resource_base_t&, const negative_t )
+        {
+        }
+
+        void
+        reserve ( const size_t, request_base_t& )
+        {
+        }
+
+        dns_cache_stats
+        stats ()
+        {
+          return dns_cache_stats();
+        }
+      };
+
+    } // namespace dns
+  } // namespace net
+} // namespace boost
+
+#endif  // BOOST_NET_DNS_NULL_CACHE_HPP
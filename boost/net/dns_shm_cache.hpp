@@ -0,0 +1,845 @@
+/*
+ dns_shm_cache.hpp
+ ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+ Copyright (c) 2008 - 2012 Andreas Haberstroh
+ (andreas at ibusy dot com)
+ (softwareace01 at google dot com)
+ (softwareace at yahoo dot com)
+
+ Distributed under the Boost Software License, Version 1.0. (See accompanying
+ file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+
+#ifndef BOOST_NET_DNS_SHM_CACHE_HPP
+#define BOOST_NET_DNS_SHM_CACHE_HPP
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <boost/net/dns.hpp>
+#include <boost/net/dns_cache.hpp>
+#include <boost/net/dns_cache_snapshot.hpp>
+#include <boost/interprocess/managed_shared_memory.hpp>
+#include <boost/interprocess/exceptions.hpp>
+#include <boost/interprocess/sync/interprocess_mutex.hpp>
+#include <boost/thread/tss.hpp>
+
+#if !defined(BOOST_NET_DNS_SHM_CACHE_NAME)
+#define BOOST_NET_DNS_SHM_CACHE_NAME "boost_net_dns_cache"
+#endif
+
+#if !defined(BOOST_NET_DNS_SHM_CACHE_SIZE)
+#define BOOST_NET_DNS_SHM_CACHE_SIZE 65536
+#endif
+
+// robust process shared mutexes, define BOOST_NET_DNS_SHM_CACHE_NO_ROBUST to use
+// boost::interprocess::interprocess_mutex instead
+#if defined(__GLIBC__) && !defined(BOOST_NET_DNS_SHM_CACHE_NO_ROBUST)
+#define BOOST_NET_DNS_SHM_CACHE_ROBUST
+#include <cerrno>
+#include <pthread.h>
+#endif
+
+namespace boost
+{
+  namespace net
+  {
+    namespace dns
+    {
+
+      /*!
+       A DNS cache in a POSIX shared memory segment, shared by every process on the host
+       that opens the same segment name. Pre-forked workers get one cache and one hit rate
+       instead of one per worker. Each worker still sends its own upstream queries.
+
+       Nothing in the segment is a pointer. The segment holds a fixed table of slots, and
+       an RRset is stored in a slot as a DNS response message (see dns_cache_snapshot_format)
+       with its absolute expiry time, so every process can decode it wherever the segment
+       is mapped. A hit decodes a private copy of the set.
+
+       The table is set associative: an RRset hashes to a bucket of 'ways' slots and may
+       only live there. Inserting into a full bucket replaces an expired RRset, otherwise
+       the least recently used one. Buckets are spread over 'shards' process shared mutexes
+       that are held only while a slot is copied in or out.
+
+       With glibc the shard mutexes are robust. When a process dies holding one, the
+       next process to lock it empties the buckets of that shard, since the slot being
+       written can't be trusted, and carries on. Elsewhere, or with
+       BOOST_NET_DNS_SHM_CACHE_NO_ROBUST defined, a dead holder leaves its shard locked
+       and every process that touches the shard hangs. Recover by calling remove() and
+       restarting the workers, they create a fresh segment.
+
+       RRsets too large for a slot are not cached. Prefetching is not supported, lookups
+       never ask for a refresh.
+
+       save_cache() and load_cache() work with it as with basic_dns_cache, so a snapshot
+       can warm a fresh segment.
+       */
+      class dns_shm_cache
+      {
+      public:
+        enum
+        {
+          /// Bytes of message data a slot holds
+          slot_bytes = 512,
+          /// Slots per bucket
+          ways = 8,
+          /// Number of bucket locks
+          shards = 64
+        };
+
+      private:
+        /*!
+         A cached RRset, key 0 marks an empty slot
+         */
+        struct shm_slot
+        {
+          boost::uint64_t _key;
+          /// Expiry in seconds since the epoch
+          boost::uint32_t _expires;
+          /// Shard tick of the last hit, for the LRU choice within a bucket
+          boost::uint32_t _used;
+          boost::uint16_t _length;
+          boost::uint8_t _negative;
+          boost::uint8_t _perm;
+          char _data[slot_bytes];
+
+          shm_slot () :
+            _key(0), _expires(0), _used(0), _length(0), _negative(negative_none), _perm(0)
+          {
+          }
+        };
+
+        /*!
+         Process shared mutex that tells the next owner when the last one died holding it
+         */
+        class shm_mutex
+        {
+#if defined(BOOST_NET_DNS_SHM_CACHE_ROBUST)
+          pthread_mutex_t _mutex;
+
+        public:
+          shm_mutex ()
+          {
+            pthread_mutexattr_t attr;
+            pthread_mutexattr_init(&attr);
+            pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+            pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+            int error(pthread_mutex_init(&_mutex, &attr));
+            pthread_mutexattr_destroy(&attr);
+            if( error )
+              throw boost::interprocess::interprocess_exception("pthread_mutex_init failed");
+          }
+
+          ~shm_mutex ()
+          {
+            pthread_mutex_destroy(&_mutex);
+          }
+
+          /*!
+           \return false if the previous owner died holding the mutex
+           */
+          bool
+          lock ()
+          {
+            int error(pthread_mutex_lock(&_mutex));
+            if( error == EOWNERDEAD )
+            {
+              pthread_mutex_consistent(&_mutex);
+              return false;
+            }
+
+            if( error )
+              throw boost::interprocess::lock_exception();
+
+            return true;
+          }
+
+          void
+          unlock ()
+          {
+            pthread_mutex_unlock(&_mutex);
+          }
+#else
+          boost::interprocess::interprocess_mutex _mutex;
+
+        public:
+          bool
+          lock ()
+          {
+            _mutex.lock();
+            return true;
+          }
+
+          void
+          unlock ()
+          {
+            _mutex.unlock();
+          }
+#endif
+        };
+
+        /*!
+         Lock and counters for a group of buckets
+         */
+        struct shm_shard
+        {
+          shm_mutex _mutex;
+          boost::uint32_t _tick;
+          boost::uint32_t _entries;
+          boost::uint64_t _bytes;
+          boost::uint64_t _evictions;
+
+          shm_shard () :
+            _mutex(), _tick(0), _entries(0), _bytes(0), _evictions(0)
+          {
+          }
+        };
+
+        /*!
+         Holds the lock of a shard, recovering the shard if its last holder died
+         */
+        class shm_lock
+        {
+          shm_mutex& _mutex;
+
+        public:
+          shm_lock ( dns_shm_cache& cache, const std::size_t shard ) :
+            _mutex(cache._shards[shard]._mutex)
+          {
+            if( !_mutex.lock() )
+              cache.recover(shard);
+          }
+
+          ~shm_lock ()
+          {
+            _mutex.unlock();
+          }
+        };
+
+        friend class shm_lock;
+
+        boost::interprocess::managed_shared_memory _segment;
+        shm_shard* _shards;
+        shm_slot* _slots;
+        std::size_t _buckets;
+
+        /// Seconds expired RRsets stay available to lookup_stale()
+        boost::uint32_t _stale_window;
+
+        /// Per thread buffer a slot is copied into for decoding, too big for the stack
+        boost::thread_specific_ptr< dns_buffer_t > _decodeBuffer;
+
+      public:
+        /*!
+         Opens the cache with the default segment name and size, see BOOST_NET_DNS_SHM_CACHE_NAME
+         and BOOST_NET_DNS_SHM_CACHE_SIZE.
+         */
+        dns_shm_cache () :
+          _segment(), _shards(0), _slots(0), _buckets(0), _stale_window(0), _decodeBuffer()
+        {
+          open(BOOST_NET_DNS_SHM_CACHE_NAME, BOOST_NET_DNS_SHM_CACHE_SIZE);
+        }
+
+        /*!
+         Opens the cache in segment 'name', creating it if no process did so yet. The process
+         that creates the segment decides its size, later ones use the segment as it is.
+
+         \param name Name of the shared memory segment
+         \param max_elements Number of RRsets the cache holds
+         \throws boost::interprocess::interprocess_exception
+         */
+        explicit
+        dns_shm_cache ( const std::string& name, const std::size_t max_elements = BOOST_NET_DNS_SHM_CACHE_SIZE ) :
+          _segment(), _shards(0), _slots(0), _buckets(0), _stale_window(0), _decodeBuffer()
+        {
+          open(name, max_elements);
+        }
+
+        /*!
+         Removes the segment 'name'. Processes that have it open keep using it.
+         */
+        static bool
+        remove ( const std::string& name )
+        {
+          return boost::interprocess::shared_memory_object::remove(name.c_str());
+        }
+
+        /*!
+         Keeps expired RRsets around for lookup_stale(), RFC 8767. The window is a setting
+         of this process, not of the segment.
+         */
+        void
+        serve_stale ( const time_duration& window )
+        {
+          _stale_window = boost::uint32_t(window.total_seconds());
+        }
+
+        /*!
+         True when serve_stale() set a window.
+         */
+        bool
+        serves_stale ( ) const
+        {
+          return _stale_window != 0;
+        }
+
+        /*!
+         Prefetching is not supported, lookups never ask for a refresh.
+         */
+        void
+        prefetch_done ( const question& )
+        {
+        }
+
+        /*!
+         */
+        bool
+        exists ( const question& q )
+        {
+          negative_t negative;
+          return bool(lookup(q, negative));
+        }
+
+        /*!
+         A cached negative answer returns an empty list.
+         */
+        rr_list_t
+        get ( const question& q )
+        {
+          negative_t negative;
+          shared_rrset_t rrset(lookup(q, negative));
+          if( !rrset || negative != negative_none )
+            return rr_list_t();
+
+          return *rrset;
+        }
+
+        /*!
+         \param q Question to look up
+         \param negative Set to the kind of negative answer when one is cached, in which
+         case the list holds the SOA of the negative answer.
+         */
+        rr_list_t
+        get ( const question& q, negative_t& negative )
+        {
+          shared_rrset_t rrset(lookup(q, negative));
+          if( !rrset )
+            return rr_list_t();
+
+          return *rrset;
+        }
+
+        /*!
+         Looks up the cached RRset for a question. The records carry the TTL they have left.
+
+         \param q Question to look up
+         \param negative Set to the kind of negative answer when one is cached, in which
+         case the set holds the SOA of the negative answer.
+         \return The cached set, empty on a miss
+         */
+        shared_rrset_t
+        lookup ( const question& q, negative_t& negative )
+        {
+          return fetch(q, negative, false);
+        }
+
+        /*!
+         Same as lookup(q, negative), refresh is always cleared.
+         */
+        shared_rrset_t
+        lookup ( const question& q, negative_t& negative, bool& refresh )
+        {
+          refresh = false;
+          return fetch(q, negative, false);
+        }
+
+        /*!
+         Looks up an RRset that is fresh or expired less than the stale window ago. The
+         records of an expired set carry a TTL of stale_ttl.
+         */
+        shared_rrset_t
+        lookup_stale ( const question& q, negative_t& negative )
+        {
+          return fetch(q, negative, true);
+        }
+
+        /*!
+         Stale answers are not counted.
+         */
+        void
+        stale_served ( )
+        {
+        }
+
+        /*!
+         Adds a record to the cached RRset of its owner, type and class. The set keeps
+         the lowest TTL of its records.
+         */
+        void
+        add ( const shared_resource_base_t& rr, const bool perm = false )
+        {
+          question q(*rr.get());
+          rr_list_t rrset(1, rr);
+
+          negative_t negative;
+          shared_rrset_t cached(lookup(q, negative));
+          if( cached && negative == negative_none )
+          {
+            shared_dns_buffer_t buffer(new dns_buffer_t);
+            wire(rr, rr->ttl(), *buffer);
+            std::string added(buffer->get_array().data(), buffer->get_array().data() + buffer->length());
+
+            for( rr_list_t::const_iterator iter = cached->begin(); iter != cached->end(); ++iter )
+            {
+              wire( ( *iter ), rr->ttl(), *buffer);
+              if( buffer->length() != added.size() || std::memcmp(buffer->get_array().data(), added.data(),
+                  added.size()) != 0 )
+                rrset.push_back( ( *iter ));
+            }
+          }
+
+          store(q, rrset, negative_none, perm);
+        }
+
+        /*!
+         Adds records, grouped into RRsets by owner, type and class. Every set replaces
+         the cached set for its question.
+         */
+        void
+        add ( const rr_list_t& records, const bool perm = false )
+        {
+          std::vector< rr_list_t > rrsets;
+          for( rr_list_t::const_iterator iter = records.begin(); iter != records.end(); ++iter )
+          {
+            std::vector< rr_list_t >::iterator set = rrsets.begin();
+            for( ; set != rrsets.end(); ++set )
+            {
+              const shared_resource_base_t& first(set->front());
+              if( first->rtype() == ( *iter )->rtype() && first->rclass() == ( *iter )->rclass()
+                  && first->domain() == ( *iter )->domain() )
+                break;
+            }
+
+            if( set == rrsets.end() )
+              rrsets.push_back(rr_list_t(1, ( *iter )));
+            else
+              set->push_back( ( *iter ));
+          }
+
+          for( std::vector< rr_list_t >::iterator set = rrsets.begin(); set != rrsets.end(); ++set )
+            store(question(*set->front().get()), *set, negative_none, perm);
+        }
+
+        /*!
+         Caches a negative answer for a question, replacing anything cached for it.
+
+         \param q Question that was answered negatively
+         \param soa SOA record from the authority section of the answer
+         \param negative Kind of negative answer
+         */
+        void
+        add_negative ( const question& q, const shared_resource_base_t& soa, const negative_t negative )
+        {
+          BOOST_ASSERT(soa->rtype() == type_soa);
+          store(q, rr_list_t(1, soa), negative, false);
+        }
+
+        /*!
+         Buckets make their own room on insert, there is nothing to reserve.
+         */
+        void
+        reserve ( const size_t, request_base_t& )
+        {
+        }
+
+        /*!
+         Exports every live RRset with its remaining TTL, for save_cache(). Permanent and
+         expired RRsets are left out. A shard stays locked only while its slots are copied.
+         */
+        void
+        entries ( std::vector< dns_cache_entry >& out )
+        {
+          boost::uint32_t nowTime(now());
+          std::vector< shm_slot > live;
+          dns_buffer_t& buffer(decode_buffer());
+          message msg;
+
+          for( std::size_t i = 0; i < shards; ++i )
+          {
+            live.clear();
+            {
+              shm_lock lock(*this, i);
+              for( std::size_t bucket = i; bucket < _buckets; bucket += shards )
+              {
+                for( shm_slot* slot = _slots + bucket * ways; slot != _slots + ( bucket + 1 ) * ways; ++slot )
+                {
+                  if( slot->_key && !slot->_perm && slot->_expires > nowTime )
+                    live.push_back(*slot);
+                }
+              }
+            }
+
+            for( std::vector< shm_slot >::const_iterator iter = live.begin(); iter != live.end(); ++iter )
+            {
+              std::memcpy(buffer.get_array().data(), iter->_data, iter->_length);
+              buffer.length(iter->_length);
+
+              rr_list_t* records(decode(buffer, negative_t(iter->_negative), msg));
+              if( !records )
+                continue;
+
+              dns_cache_entry entry;
+              entry.q = msg.questions()->front();
+              entry.records.reset(new rr_list_t(*records));
+              entry.negative = negative_t(iter->_negative);
+              entry.ttl = iter->_expires - nowTime;
+              out.push_back(entry);
+            }
+          }
+        }
+
+        /*!
+         Restores an RRset exported by entries(). The records' TTLs are set to the remaining
+         TTL, so the records must not be shared with anything else.
+         */
+        void
+        restore ( const question& q, const rr_list_t& records, const negative_t negative, const uint32_t ttl )
+        {
+          if( records.empty() || !ttl )
+            return;
+
+          for( rr_list_t::const_iterator iter = records.begin(); iter != records.end(); ++iter )
+            ( *iter )->ttl(ttl);
+
+          store(q, records, negative, false);
+        }
+
+        /*!
+         Restores a batch of RRsets exported by entries(). The table has a fixed size, so
+         remaining is only there for load_cache().
+         */
+        void
+        restore ( const std::vector< dns_cache_entry >& batch, const std::size_t remaining = 0 )
+        {
+          for( std::vector< dns_cache_entry >::const_iterator iter = batch.begin(); iter != batch.end(); ++iter )
+          {
+            if( iter->records )
+              restore(iter->q, *iter->records, iter->negative, iter->ttl);
+          }
+        }
+
+        /*!
+         Current occupancy of the whole segment. Bytes are the message bytes held in slots.
+         */
+        dns_cache_stats
+        stats ()
+        {
+          dns_cache_stats s;
+
+          for( std::size_t i = 0; i < shards; ++i )
+          {
+            shm_lock lock(*this, i);
+            s.bytes += std::size_t(_shards[i]._bytes);
+            s.entries += _shards[i]._entries;
+            s.evictions += std::size_t(_shards[i]._evictions);
+          }
+
+          return s;
+        }
+
+      private:
+        void
+        open ( const std::string& name, const std::size_t max_elements )
+        {
+          using namespace boost::interprocess;
+
+          std::size_t buckets(( std::max )(( max_elements + ways - 1 ) / ways, std::size_t(1)));
+          std::size_t size(sizeof(shm_shard) * shards + sizeof(shm_slot) * buckets * ways);
+
+          // room for the segment manager and the two named objects
+          _segment = managed_shared_memory(open_or_create, name.c_str(), size + size / 64 + 65536);
+
+          _shards = _segment.find_or_construct< shm_shard > ("shards")[shards]();
+          _slots = _segment.find_or_construct< shm_slot > ("slots")[buckets * ways]();
+
+          // the segment may have been created with another size
+          _buckets = _segment.find< shm_slot > ("slots").second / ways;
+        }
+
+        static boost::uint32_t
+        now ()
+        {
+          return boost::uint32_t(dns_cache_snapshot_format::now());
+        }
+
+        /*!
+         FNV-1a over the case folded question. It has to come out the same in every
+         process, so no seeded or library dependent hashing.
+         */
+        static boost::uint64_t
+        key ( const request_base_t& q )
+        {
+          boost::uint64_t h(0xcbf29ce484222325ULL);
+          const std::string& domain(q.domain());
+          for( std::string::const_iterator iter = domain.begin(); iter != domain.end(); ++iter )
+          {
+            char c(*iter);
+            if( c >= 'A' && c <= 'Z' )
+              c += 'a' - 'A';
+
+            h = ( h ^ boost::uint8_t(c) ) * 0x100000001b3ULL;
+          }
+
+          h = ( h ^ boost::uint16_t(q.rtype()) ) * 0x100000001b3ULL;
+          h = ( h ^ boost::uint16_t(q.rclass()) ) * 0x100000001b3ULL;
+
+          return h ? h : 1;
+        }
+
+        static bool
+        matches ( const request_base_t& cached, const request_base_t& q )
+        {
+          if( cached.rtype() != q.rtype() || cached.rclass() != q.rclass() || cached.domain().size()
+              != q.domain().size() )
+            return false;
+
+          for( std::size_t i = 0; i < q.domain().size(); ++i )
+          {
+            char a(cached.domain()[i]), b(q.domain()[i]);
+            if( a >= 'A' && a <= 'Z' )
+              a += 'a' - 'A';
+            if( b >= 'A' && b <= 'Z' )
+              b += 'a' - 'A';
+            if( a != b )
+              return false;
+          }
+
+          return true;
+        }
+
+        /*!
+         Encodes a single record, with ttl in place of its own, so records can be compared
+         by their wire form.
+         */
+        static void
+        wire ( const shared_resource_base_t& rr, const uint32_t ttl, dns_buffer_t& buffer )
+        {
+          uint32_t savedTtl(rr->ttl());
+          rr->ttl(ttl);
+
+          message msg;
+          msg.answers()->push_back(rr);
+          buffer.length(0);
+          msg.encode(buffer);
+
+          rr->ttl(savedTtl);
+        }
+
+        dns_buffer_t&
+        decode_buffer ( )
+        {
+          dns_buffer_t* buffer(_decodeBuffer.get());
+          if( !buffer )
+          {
+            buffer = new dns_buffer_t;
+            _decodeBuffer.reset(buffer);
+          }
+
+          buffer->position(0);
+          return *buffer;
+        }
+
+        /*!
+         Decodes a cached message, returns the section holding the RRset or 0 if the
+         message doesn't decode.
+         */
+        static rr_list_t*
+        decode ( dns_buffer_t& buffer, const negative_t negative, message& msg )
+        {
+          try
+          {
+            msg.decode(buffer);
+          }
+          catch( std::exception& )
+          {
+            return 0;
+          }
+
+          if( msg.questions()->empty() )
+            return 0;
+
+          return ( negative == negative_none ) ? msg.answers() : msg.authorites();
+        }
+
+        static std::size_t
+        shard ( const std::size_t bucket )
+        {
+          return bucket % shards;
+        }
+
+        /*!
+         Empties the buckets of a shard whose lock holder died, with the lock held.
+         */
+        void
+        recover ( const std::size_t index )
+        {
+          for( std::size_t bucket = index; bucket < _buckets; bucket += shards )
+          {
+            for( shm_slot* slot = _slots + bucket * ways; slot != _slots + ( bucket + 1 ) * ways; ++slot )
+              slot->_key = 0;
+          }
+
+          _shards[index]._entries = 0;
+          _shards[index]._bytes = 0;
+        }
+
+        void
+        store ( const question& q, const rr_list_t& rrset, const negative_t negative, const bool perm )
+        {
+          if( rrset.empty() )
+            return;
+
+          uint32_t ttl(rrset.front()->ttl());
+          for( rr_list_t::const_iterator iter = rrset.begin(); iter != rrset.end(); ++iter )
+            ttl = ( std::min )(ttl, ( *iter )->ttl());
+
+          if( negative != negative_none )
+            ttl = ( std::min )(ttl, ( (soa_resource*) rrset.front().get() )->minttl());
+
+          dns_cache_entry entry;
+          entry.q = q;
+          entry.records.reset(new rr_list_t(rrset));
+          entry.negative = negative;
+          entry.ttl = ttl;
+
+          shared_dns_buffer_t buffer(new dns_buffer_t);
+          if( !dns_cache_snapshot_format::encode(entry, *buffer) || buffer->length() > slot_bytes )
+            return;
+
+          boost::uint64_t k(key(q));
+          std::size_t bucket(std::size_t(k % _buckets));
+          shm_slot* first(_slots + bucket * ways);
+          shm_shard& s(_shards[shard(bucket)]);
+          boost::uint32_t nowTime(now());
+
+          shm_lock lock(*this, shard(bucket));
+
+          // the slot already holding the key, else an empty or dead slot, else the LRU one
+          shm_slot* target(0);
+          shm_slot* lru(0);
+          for( shm_slot* slot = first; slot != first + ways; ++slot )
+          {
+            if( slot->_key == k )
+            {
+              target = slot;
+              break;
+            }
+
+            if( !slot->_key || ( !slot->_perm && slot->_expires + _stale_window < nowTime ) )
+            {
+              if( !target )
+                target = slot;
+              continue;
+            }
+
+            if( !slot->_perm && ( !lru || boost::uint32_t(s._tick - slot->_used) > boost::uint32_t(s._tick
+                - lru->_used) ) )
+              lru = slot;
+          }
+
+          if( !target )
+          {
+            if( !lru )
+              return;
+
+            target = lru;
+            ++s._evictions;
+          }
+
+          if( target->_key )
+          {
+            --s._entries;
+            s._bytes -= target->_length;
+          }
+
+          target->_key = k;
+          target->_expires = nowTime + ttl;
+          target->_used = ++s._tick;
+          target->_length = boost::uint16_t(buffer->length());
+          target->_negative = boost::uint8_t(negative);
+          target->_perm = perm;
+          std::memcpy(target->_data, buffer->get_array().data(), buffer->length());
+
+          ++s._entries;
+          s._bytes += target->_length;
+        }
+
+        shared_rrset_t
+        fetch ( const question& q, negative_t& negative, const bool stale )
+        {
+          negative = negative_none;
+
+          boost::uint64_t k(key(q));
+          std::size_t bucket(std::size_t(k % _buckets));
+          shm_slot* first(_slots + bucket * ways);
+          boost::uint32_t nowTime(now());
+
+          dns_buffer_t& buffer(decode_buffer());
+          negative_t cachedNegative(negative_none);
+          boost::uint32_t left(0);
+          bool expired(false);
+          {
+            shm_shard& s(_shards[shard(bucket)]);
+            shm_lock lock(*this, shard(bucket));
+
+            shm_slot* slot(first);
+            for( ; slot != first + ways; ++slot )
+            {
+              if( slot->_key == k )
+                break;
+            }
+
+            if( slot == first + ways )
+              return shared_rrset_t();
+
+            expired = !slot->_perm && slot->_expires <= nowTime;
+            if( expired && ( !stale || slot->_expires + _stale_window < nowTime ) )
+              return shared_rrset_t();
+
+            slot->_used = ++s._tick;
+
+            std::memcpy(buffer.get_array().data(), slot->_data, slot->_length);
+            buffer.length(slot->_length);
+            cachedNegative = negative_t(slot->_negative);
+            left = ( expired || slot->_perm ) ? 0 : slot->_expires - nowTime;
+          }
+
+          message msg;
+          rr_list_t* records(decode(buffer, cachedNegative, msg));
+          if( !records || !matches(msg.questions()->front(), q) )
+            return shared_rrset_t();
+
+          if( left )
+          {
+            for( rr_list_t::iterator iter = records->begin(); iter != records->end(); ++iter )
+              ( *iter )->ttl(left);
+          }
+          else if( expired )
+          {
+            for( rr_list_t::iterator iter = records->begin(); iter != records->end(); ++iter )
+              ( *iter )->ttl(stale_ttl);
+          }
+
+          negative = cachedNegative;
+          return shared_rrset_t(new rr_list_t(*records));
+        }
+      };
+
+    } // namespace dns
+  } // namespace net
+} // namespace boost
+
+#endif  // BOOST_NET_DNS_SHM_CACHE_HPP
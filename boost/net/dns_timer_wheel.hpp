@@ -0,0 +1,192 @@
+/*
+ dns_timer_wheel.hpp
+ ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+ Copyright (c) 2008 - 2012 Andreas Haberstroh
+ (andreas at ibusy dot com)
+ (softwareace01 at google dot com)
+ (softwareace at yahoo dot com)
+
+ Distributed under the Boost Software License, Version 1.0. (See accompanying
+ file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+
+#ifndef BOOST_NET_DNS_TIMER_WHEEL_HPP
+#define BOOST_NET_DNS_TIMER_WHEEL_HPP
+
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+namespace boost
+{
+  namespace net
+  {
+    namespace dns
+    {
+
+      /*!
+       Hashed timer wheel with millisecond ticks, for many short timers that are mostly
+       cancelled before they fire.
+
+       A timer goes into the slot of its tick modulo 'slots', so scheduling is O(1) and
+       a tick only looks at the timers of its own slot. Timers further out than one
+       turn of the wheel share a slot with nearer ones and wait for their tick there.
+
+       Timers can't be cancelled, the owner of an Entry has to tell a stale one from a
+       live one when it expires. One timer of the caller's choice drives the wheel: it
+       should wake up at next_expiry() and call expire().
+       */
+      template<typename Entry>
+        class dns_timer_wheel
+        {
+        public:
+          enum
+          {
+            slots = 1024
+          };
+
+        private:
+          struct timer
+          {
+            boost::uint64_t _tick;
+            Entry _entry;
+
+            timer ( const boost::uint64_t tick, const Entry& entry ) :
+              _tick(tick), _entry(entry)
+            {
+            }
+          };
+
+          typedef std::vector< timer > slot_t;
+
+          /// Time of tick 0
+          posix_time::ptime _epoch;
+          /// Next tick to expire
+          boost::uint64_t _current;
+          std::size_t _size;
+          std::vector< slot_t > _slots;
+
+        public:
+          explicit
+          dns_timer_wheel ( const posix_time::ptime& now ) :
+            _epoch(now), _current(0), _size(0), _slots(slots)
+          {
+          }
+
+          /*!
+           Schedules entry to expire at the first tick not before when, or with the next
+           tick if when has passed.
+
+           \return Time of the tick the entry expires with
+           */
+          posix_time::ptime
+          schedule ( const posix_time::ptime& when, const Entry& entry )
+          {
+            boost::uint64_t t(tick(when + posix_time::microseconds(999)));
+            if( t < _current )
+              t = _current;
+
+            _slots[t % slots].push_back(timer(t, entry));
+            ++_size;
+
+            return _epoch + posix_time::milliseconds(t);
+          }
+
+          /*!
+           Moves the wheel to now, appending every entry that expired to due. At most one
+           turn of the wheel is walked, however long it has been.
+           */
+          void
+          expire ( const posix_time::ptime& now, std::vector< Entry >& due )
+          {
+            boost::uint64_t t(tick(now));
+            if( t < _current )
+              return;
+
+            boost::uint64_t ticks(t - _current + 1);
+            if( ticks > slots )
+              ticks = slots;
+
+            for( boost::uint64_t i = 0; i < ticks && _size; ++i )
+            {
+              slot_t& slot(_slots[( _current + i ) % slots]);
+              for( std::size_t j = 0; j < slot.size(); )
+              {
+                if( slot[j]._tick > t )
+                {
+                  ++j;
+                  continue;
+                }
+
+                due.push_back(slot[j]._entry);
+                slot[j] = slot.back();
+                slot.pop_back();
+                --_size;
+              }
+            }
+
+            _current = t + 1;
+          }
+
+          /*!
+           When the wheel should be moved next, the tick of the nearest slot that holds a
+           timer. not_a_date_time if the wheel is empty.
+           */
+          posix_time::ptime
+          next_expiry () const
+          {
+            if( !_size )
+              return posix_time::ptime(posix_time::not_a_date_time);
+
+            for( boost::uint64_t i = 0; i < slots; ++i )
+            {
+              if( !_slots[( _current + i ) % slots].empty() )
+                return _epoch + posix_time::milliseconds(_current + i);
+            }
+
+            return _epoch + posix_time::milliseconds(_current);
+          }
+
+          /*!
+           Drops every timer
+           */
+          void
+          clear ()
+          {
+            for( std::size_t i = 0; i < slots && _size; ++i )
+            {
+              _size -= _slots[i].size();
+              _slots[i].clear();
+            }
+          }
+
+          std::size_t
+          size () const
+          {
+            return _size;
+          }
+
+          bool
+          empty () const
+          {
+            return !_size;
+          }
+
+        private:
+          boost::uint64_t
+          tick ( const posix_time::ptime& when ) const
+          {
+            if( when <= _epoch )
+              return 0;
+
+            return boost::uint64_t(( when - _epoch ).total_milliseconds());
+          }
+        };
+
+    } // namespace dns
+  } // namespace net
+} // namespace boost
+
+#endif  // BOOST_NET_DNS_TIMER_WHEEL_HPP
@@ -0,0 +1,359 @@
+/*
+ dns_upstream.hpp
+ ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+ Copyright (c) 2008 - 2012 Andreas Haberstroh
+ (andreas at ibusy dot com)
+ (softwareace01 at google dot com)
+ (softwareace at yahoo dot com)
+
+ Distributed under the Boost Software License, Version 1.0. (See accompanying
+ file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+ */
+
+#ifndef BOOST_NET_DNS_UPSTREAM_HPP
+#define BOOST_NET_DNS_UPSTREAM_HPP
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#include <boost/asio.hpp>
+#include <boost/random.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+namespace boost
+{
+  namespace net
+  {
+    namespace dns
+    {
+
+      /*!
+       What a resolver has seen of one upstream nameserver: a smoothed round trip time,
+       its variation and an error rate, and the retransmission timeout that follows
+       from them as in RFC 6298.
+
+       Every query that times out doubles the timeout of the server, up to 64 times,
+       until it answers again. The backoff also weighs on the score, so a server that
+       drops queries falls behind one that is merely slow.
+
+       The round trips of the last 'window' answers are kept for latency percentiles.
+       */
+      class dns_upstream
+      {
+      public:
+        enum
+        {
+          window = 128, max_backoff = 64
+        };
+
+        explicit
+        dns_upstream ( const boost::asio::ip::udp::endpoint& endpoint ) :
+          _endpoint(endpoint), _srtt(0.0), _rttvar(0.0), _errors(0.0), _samples(0), _backoff(1), _edns(true), _rtts(),
+              _next(0), _p95(0.0), _p95_age(0)
+        {
+        }
+
+        const boost::asio::ip::udp::endpoint&
+        endpoint () const
+        {
+          return _endpoint;
+        }
+
+        /// An answer came back after rtt
+        void
+        answered ( const posix_time::time_duration& rtt )
+        {
+          double r(double(rtt.total_microseconds()));
+          if( !_samples++ )
+          {
+            _srtt = r;
+            _rttvar = r / 2.0;
+          }
+          else
+          {
+            _rttvar += ( std::fabs(_srtt - r) - _rttvar ) / 4.0;
+            _srtt += ( r - _srtt ) / 8.0;
+          }
+
+          if( _rtts.size() < window )
+            _rtts.push_back(r);
+          else
+            _rtts[_next] = r;
+
+          _next = ( _next + 1 ) % window;
+          ++_p95_age;
+
+          succeeded();
+        }
+
+        /// An answer came back to a retransmitted query, which can't be timed (Karn)
+        void
+        succeeded ()
+        {
+          error(0.0);
+          _backoff = 1;
+        }
+
+        /// An answer that is no use, SERVFAIL or REFUSED
+        void
+        failed ()
+        {
+          error(1.0);
+        }
+
+        /// No answer within the retransmission timeout
+        void
+        timed_out ()
+        {
+          error(1.0);
+          if( _backoff < max_backoff )
+            _backoff *= 2;
+        }
+
+        /// A query with EDNS0 got FORMERR without an OPT record, RFC 6891 section 7
+        void
+        edns_failed ()
+        {
+          _edns = false;
+        }
+
+        /// False once the server showed it doesn't understand EDNS0
+        bool
+        edns () const
+        {
+          return _edns;
+        }
+
+        /// Smoothed round trip time in microseconds, 0 until measured
+        double
+        srtt () const
+        {
+          return _srtt;
+        }
+
+        /// Fraction of recent queries that went unanswered or failed
+        double
+        error_rate () const
+        {
+          return _errors;
+        }
+
+        bool
+        measured () const
+        {
+          return _samples != 0;
+        }
+
+        /*!
+         Retransmission timeout, SRTT + 4 * RTTVAR with a clock granularity of 1 ms,
+         1 second before the first answer. At least min before the backoff, at most max
+         after it.
+         */
+        posix_time::time_duration
+        rto ( const posix_time::time_duration& min, const posix_time::time_duration& max ) const
+        {
+          double us(measured() ? _srtt + ( std::max )(1000.0, 4.0 * _rttvar) : 1000000.0);
+          us = ( std::max )(us, double(min.total_microseconds()));
+
+          posix_time::time_duration timeout(posix_time::microseconds(( boost::int64_t ) ( us * _backoff )));
+          if( timeout > max )
+            return max;
+
+          return timeout;
+        }
+
+        /*!
+         95th percentile of the recent round trips in microseconds, 0 until there are
+         enough answers to tell. Recomputed every 16 answers.
+         */
+        double
+        p95 ()
+        {
+          if( _rtts.size() < 20 )
+            return 0.0;
+
+          if( _p95_age >= 16 || _p95 == 0.0 )
+          {
+            std::vector< double > sorted(_rtts);
+            std::vector< double >::iterator nth(sorted.begin() + ( sorted.size() * 95 ) / 100);
+            std::nth_element(sorted.begin(), nth, sorted.end());
+            _p95 = *nth;
+            _p95_age = 0;
+          }
+
+          return _p95;
+        }
+
+        /*!
+         Expected cost of a query to this server, lower is better. 0 for a server that
+         hasn't been tried, a server that never answered costs its initial timeout.
+         */
+        double
+        score () const
+        {
+          if( !measured() )
+            return ( _backoff == 1 ) ? 0.0 : 1000000.0 * _backoff;
+
+          return _srtt * _backoff * ( 1.0 + _errors );
+        }
+
+      private:
+        void
+        error ( const double e )
+        {
+          _errors += ( e - _errors ) / 8.0;
+        }
+
+        boost::asio::ip::udp::endpoint _endpoint;
+        double _srtt;
+        double _rttvar;
+        double _errors;
+        std::size_t _samples;
+        /// Timeout multiplier, doubled by every timeout and reset by an answer
+        std::size_t _backoff;
+        bool _edns;
+
+        /// Recent round trips in microseconds, a ring once full
+        std::vector< double > _rtts;
+        std::size_t _next;
+        double _p95;
+        /// Answers since _p95 was computed
+        std::size_t _p95_age;
+      };
+
+      /*!
+       The upstream nameservers of a resolver, and the choice of which one gets a query.
+
+       Servers that haven't been timed yet go first, so every server gets
+       measured. After that the lowest score wins, except for a small fraction of
+       queries that go to a random other server, so a server that was slow or down
+       gets the chance to show it recovered.
+       */
+      class dns_upstreams
+      {
+      public:
+        typedef std::vector< dns_upstream > upstream_vector_t;
+
+        enum
+        {
+          none = -1
+        };
+
+        dns_upstreams () :
+          _upstreams(), _explore(0.02), _rng(), _unit(0.0, 1.0)
+        {
+        }
+
+        void
+        add ( const boost::asio::ip::udp::endpoint& endpoint )
+        {
+          _upstreams.push_back(dns_upstream(endpoint));
+        }
+
+        /*!
+         \param fraction Share of queries sent to a random server other than the best one
+         */
+        void
+        explore ( const double fraction )
+        {
+          _explore = fraction;
+        }
+
+        std::size_t
+        size () const
+        {
+          return _upstreams.size();
+        }
+
+        bool
+        empty () const
+        {
+          return _upstreams.empty();
+        }
+
+        dns_upstream&
+        operator[] ( const std::size_t i )
+        {
+          return _upstreams[i];
+        }
+
+        const dns_upstream&
+        operator[] ( const std::size_t i ) const
+        {
+          return _upstreams[i];
+        }
+
+        /*!
+         Index of the server at endpoint, none if it isn't one of ours
+         */
+        int
+        find ( const boost::asio::ip::udp::endpoint& endpoint ) const
+        {
+          for( std::size_t i = 0; i < _upstreams.size(); ++i )
+          {
+            if( _upstreams[i].endpoint() == endpoint )
+              return int(i);
+          }
+
+          return none;
+        }
+
+        /*!
+         Picks the server for the next query.
+
+         \param exclude Server to avoid, when there is another one
+         \return Index of the server, none if there are no servers
+         */
+        int
+        select ( const int exclude = none )
+        {
+          if( _upstreams.empty() )
+            return none;
+
+          if( _upstreams.size() == 1 )
+            return 0;
+
+          int best(best_of(exclude));
+          if( _explore > 0.0 && _unit(_rng) < _explore )
+          {
+            std::size_t pick(_rng() % ( _upstreams.size() - 1 ));
+            if( int(pick) >= best )
+              ++pick;
+
+            if( int(pick) != exclude )
+              return int(pick);
+          }
+
+          return best;
+        }
+
+      private:
+        int
+        best_of ( const int exclude ) const
+        {
+          int best(none);
+          for( std::size_t i = 0; i < _upstreams.size(); ++i )
+          {
+            if( int(i) == exclude )
+              continue;
+
+            if( best == none || _upstreams[i].score() < _upstreams[best].score() )
+              best = int(i);
+          }
+
+          return best;
+        }
+
+        upstream_vector_t _upstreams;
+        double _explore;
+        boost::mt19937 _rng;
+        boost::uniform_real< > _unit;
+      };
+
+    } // namespace dns
+  } // namespace net
+} // namespace boost
+
+#endif  // BOOST_NET_DNS_UPSTREAM_HPP
@@ -14,392 +14,1835 @@
 #ifndef BOOST_NET_DNS_RESOLVER_IMPL_HPP
 #define BOOST_NET_DNS_RESOLVER_IMPL_HPP
 
+#include <deque>
 #include <vector>
 
+#include <boost/unordered_map.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/net/dns_cache.hpp>
+#include <boost/net/dns_null_cache.hpp>
+#include <boost/net/dns_upstream.hpp>
+#include <boost/net/dns_timer_wheel.hpp>
+#if defined(BOOST_NET_DNS_SHM_CACHE)
+#include <boost/net/dns_shm_cache.hpp>
+#endif
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
 #include <boost/random.hpp>
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/algorithm/string/case_conv.hpp>
 #include <boost/thread/detail/singleton.hpp>
 
-using namespace boost::multi_index;
+namespace boost
+{
+  namespace net
+  {
+    namespace dns
+    {
+
+#if defined(BOOST_NET_DNS_SHM_CACHE)
+      /// Cache of resolvers that aren't given one, shared with every process on the host
+      typedef net::dns::dns_shm_cache dns_default_cache_t;
+#else
+      /// Cache of resolvers that aren't given one
+      typedef net::dns::dns_cache_t dns_default_cache_t;
+#endif
+
+      /// Single instance of the default dns cache
+      typedef boost::detail::thread::singleton< dns_default_cache_t > dns_cache_object;
+
+      /*!
+       Resolver implementation over a cache of type Cache.
+
+       A resolver uses the process wide instance of Cache, unless it is given a cache
+       of its own, which has to outlive the resolver. Cache may be any of basic_dns_cache,
+       dns_shm_cache or dns_null_cache, the latter compiles the cache path away.
+       */
+      template<typename Cache = dns_default_cache_t>
+        class basic_dns_resolver_impl
+        {
+        public:
+          typedef Cache cache_type;
+
+        private:
+          class dns_handler_base
+          {
+          public:
+            dns_handler_base ()
+            {
+            }
+
+            virtual
+            ~dns_handler_base ()
+            {
+            }
+
+            virtual void
+            invoke ( io_service& ios, const shared_resource_base_t& record, const boost::system::error_code& ec )
+            {
+            }
+          };
+
+          typedef shared_ptr< dns_handler_base > dns_handler_base_t;
+
+          /// Releases the cache's prefetch budget once the last copy of a prefetch handler is gone
+          class prefetch_ticket
+          {
+          public:
+            prefetch_ticket ( Cache& cache, const net::dns::question& q ) :
+              _cache(cache), _question(q)
+            {
+            }
+
+            ~prefetch_ticket ()
+            {
+              _cache.prefetch_done(_question);
+            }
+
+          private:
+            Cache& _cache;
+            net::dns::question _question;
+          };
+
+          /// Completion handler of a refresh-ahead query, the answer only goes to the cache
+          class prefetch_handler
+          {
+          public:
+            prefetch_handler ( Cache& cache, const net::dns::question& q ) :
+              _ticket(new prefetch_ticket(cache, q))
+            {
+            }
+
+            void
+            operator() ( const shared_resource_base_t&, const boost::system::error_code& ) const
+            {
+            }
+
+          private:
+            shared_ptr< prefetch_ticket > _ticket;
+          };
+
+          /*!
+           Decides whether the upstream or the stale answer reaches the caller, the first one
+           wins. Holds the stale answer, looked up once when the race starts.
+           */
+          class stale_race
+          {
+          public:
+            typedef enum
+            {
+              pending, upstream, stale
+            } winner_t;
+
+            stale_race ( const shared_rrset_t& rrset, const negative_t negative ) :
+              rrset(rrset), negative(negative), _winner(pending)
+            {
+            }
+
+            bool
+            claim ( const winner_t w )
+            {
+              boost::mutex::scoped_lock scopeLock(_mutex);
+              if( _winner == pending )
+                _winner = w;
+
+              return _winner == w;
+            }
+
+            const shared_rrset_t rrset;
+            const negative_t negative;
+
+          private:
+            boost::mutex _mutex;
+            winner_t _winner;
+          };
+
+          /*!
+           Completion handler for a query that may also be answered stale. An upstream
+           that answers stops the stale timer. An upstream that fails, rather than saying
+           the name or data doesn't exist, leaves the caller with the stale data, as in
+           RFC 8767.
+           */
+          template<typename Handler>
+            class stale_handler
+            {
+            public:
+              stale_handler (
+                  Handler h,
+                  const shared_ptr< stale_race >& race,
+                  const shared_ptr< deadline_timer >& timer,
+                  Cache& cache ) :
+                handler_(h), _race(race), _timer(timer), _cache(&cache)
+              {
+              }
+
+              void
+              operator() ( const shared_resource_base_t& record, const boost::system::error_code& ec )
+              {
+                if( !_race->claim(stale_race::upstream) )
+                  return;
+
+                boost::system::error_code ignored;
+                _timer->cancel(ignored);
+
+                if( ec && ec != error::not_found )
+                {
+                  _cache->stale_served();
+                  if( _race->negative != negative_none )
+                  {
+                    handler_(shared_resource_base_t(), error::not_found);
+                    return;
+                  }
+
+                  for( rr_list_t::const_iterator iter = _race->rrset->begin(); iter != _race->rrset->end(); ++iter )
+                    handler_(*iter, boost::system::error_code());
+                  return;
+                }
+
+                handler_(record, ec);
+              }
+
+            private:
+              Handler handler_;
+              shared_ptr< stale_race > _race;
+              /// Serves the stale answer if the upstream takes too long
+              shared_ptr< deadline_timer > _timer;
+              Cache* _cache;
+            };
+
+          /// Handler to wrap asynchronous callback function
+          template<typename Handler>
+            class dns_handler : public dns_handler_base
+            {
+            public:
+              dns_handler ( Handler h ) :
+                dns_handler_base(), handler_(h)
+              {
+              }
+
+              virtual
+              ~dns_handler ()
+              {
+              }
+
+              virtual void
+              invoke ( io_service& ios, const shared_resource_base_t& record, const boost::system::error_code& ec )
+              {
+                ios.post(boost::asio::detail::bind_handler(handler_, record, ec));
+              }
+
+            private:
+              Handler handler_;
+            };
+
+          /*!
+           DNS Query structure
+           */
+          struct dns_query_t
+          {
+            dns_query_t ( const net::dns::question& q, const posix_time::ptime& deadline, const unsigned retries ) :
+              _upstream(dns_upstreams::none), _hedge_upstream(dns_upstreams::none), _deadline(deadline), _retries(retries),
+                  _tries(0), _port(0), _tcp(false), _edns(false), _failed(), _failures(0)
+            {
+              _question = q;
+            }
+
+            dns_query_t ( const dns_query_t& o )
+            {
+              operator=(o);
+            }
+
+            virtual
+            ~dns_query_t ()
+            {
+            }
+
+            const dns_query_t&
+            operator= ( const dns_query_t& o )
+            {
+              _question_id = o._question_id;
+              _generation = o._generation;
+              _packet = o._packet;
+              _plain = o._plain;
+              _question = o._question;
+              _callbacks = o._callbacks;
+              _upstream = o._upstream;
+              _sent = o._sent;
+              _hedge_upstream = o._hedge_upstream;
+              _hedge_sent = o._hedge_sent;
+              _deadline = o._deadline;
+              _retries = o._retries;
+              _tries = o._tries;
+              _port = o._port;
+              _tcp = o._tcp;
+              _edns = o._edns;
+              _failed = o._failed;
+              _failures = o._failures;
+              return *this;
+            }
+
+            /// Question ID
+            uint16_t _question_id;
+
+            /// Generation of the ID's slot when the query took it
+            uint32_t _generation;
+
+            /// The query as it goes on the wire with an EDNS0 OPT record. Encoded once, as
+            /// sends still in flight read it
+            std::vector< uint8_t > _packet;
+
+            /// The query without the OPT record, encoded the first time a send needs it
+            std::vector< uint8_t > _plain;
+
+            /// DNS Query question
+            net::dns::question _question;
+
+            /// Completion handlers of every caller waiting for this question
+            std::vector< dns_handler_base_t > _callbacks;
+
+            /// Nameserver the query was last sent to, none when it went to all of them
+            int _upstream;
+
+            /// When the query was last sent
+            posix_time::ptime _sent;
+
+            /// Nameserver the hedged copy went to, none if the query wasn't hedged
+            int _hedge_upstream;
+
+            /// When the hedged copy was sent
+            posix_time::ptime _hedge_sent;
+
+            /// The query times out at this time, whatever retries it has left
+            posix_time::ptime _deadline;
+
+            /// Retransmissions allowed after the first send
+            unsigned _retries;
+
+            /// Sends so far
+            unsigned _tries;
+
+            /// Port of the pool the query is sent and answered on
+            std::size_t _port;
+
+            /// Sent over TCP since an answer came back truncated
+            bool _tcp;
+
+            /// Sent with the OPT record to nameservers that understand EDNS0
+            bool _edns;
+
+            /// Nameservers that turned down the broadcast query, by index
+            std::vector< bool > _failed;
+
+            /// Number of them
+            std::size_t _failures;
+          };
+
+          typedef shared_ptr< dns_query_t > shared_dq_t;
+
+          /*!
+           Slot of the query ID table. The generation moves on every time the slot is
+           released, so work queued for an earlier query on the same ID can tell.
+           */
+          struct query_slot
+          {
+            query_slot () :
+              _query(), _generation(0), _active(0)
+            {
+            }
+
+            /// Query in flight on this ID, empty when the ID is free
+            shared_dq_t _query;
+
+            uint32_t _generation;
+
+            /// Position of the ID in _active while the slot is in use
+            uint32_t _active;
+          };
+
+          enum
+          {
+            /// One slot per 16 bit query ID
+            query_ids = 65536,
+            /// Slots of the resolver a blocking resolve() runs its one query on
+            blocking_ids = 16
+          };
+
+          /*!
+           A timer of a query on the timer wheel. It is stale once the query on its ID
+           finished, or for a retransmission, once the query was sent again.
+           */
+          struct query_timer
+          {
+            enum kind_t
+            {
+              retry, hedge
+            };
+
+            query_timer ( const kind_t kind, const uint16_t id, const uint32_t generation, const unsigned tries ) :
+              _kind(kind), _id(id), _generation(generation), _tries(tries)
+            {
+            }
+
+            kind_t _kind;
+            uint16_t _id;
+            uint32_t _generation;
+            /// Sends of the query when the timer was set
+            unsigned _tries;
+          };
+
+          /*!
+           A socket of the pool. It keeps one receive outstanding while its port has
+           queries in flight.
+           */
+          struct udp_channel
+          {
+            udp_channel ( io_service& ios, const std::size_t port, const int upstream ) :
+              _socket(ios), _port(port), _upstream(upstream), _receiving(false), _buffer(new dns_buffer_t), _sender()
+            {
+            }
+
+            ip::udp::socket _socket;
+            /// Port of the pool the socket belongs to
+            std::size_t _port;
+            /// Nameserver the socket is connected to, none if it isn't connected
+            int _upstream;
+            bool _receiving;
+            /// Where the outstanding receive goes
+            shared_dns_buffer_t _buffer;
+            ip::udp::endpoint _sender;
+          };
+
+          typedef shared_ptr< udp_channel > shared_channel_t;
+
+          /*!
+           A port of the pool: a socket bound to an ephemeral port of its own, and when
+           the resolver connects its sockets, one socket connected to every nameserver
+           the port has sent to.
+           */
+          struct udp_port
+          {
+            udp_port () :
+              _socket(), _connected(), _queries(0)
+            {
+            }
+
+            shared_channel_t _socket;
+            /// Connected sockets by nameserver, empty until the first send to it
+            std::vector< shared_channel_t > _connected;
+            /// Queries in flight on this port
+            std::size_t _queries;
+          };
+
+          /*!
+           A TCP connection to a nameserver, kept open between queries as in RFC 7766.
+           Queries are written one after the other without waiting for answers, which
+           come back in any order and are matched by ID like those over UDP.
+           */
+          struct tcp_connection
+          {
+            tcp_connection ( io_service& ios, const int upstream ) :
+              _socket(ios), _upstream(upstream), _open(false), _reading(false), _writing(false), _writes(), _buffer(
+                  new dns_buffer_t), _used()
+            {
+            }
+
+            ip::tcp::socket _socket;
+            int _upstream;
+            /// Connected, until then queries queue up in _writes
+            bool _open;
+            bool _reading;
+            bool _writing;
+            /// Length prefixed queries waiting to be written, the first one is being written
+            std::deque< shared_ptr< std::vector< uint8_t > > > _writes;
+            /// Length prefix of the message being read
+            uint8_t _length[2];
+            shared_dns_buffer_t _buffer;
+            /// Last time a query was written or an answer read
+            posix_time::ptime _used;
+          };
+
+          typedef shared_ptr< tcp_connection > shared_tcp_t;
+
+          io_service& _ios;
+          /// Drives the timer wheel, set to its next expiry
+          deadline_timer _timer;
+          /// When _timer fires, not_a_date_time while it isn't set
+          posix_time::ptime _timer_expiry;
+          /// Retransmission and hedge timers of the queries in flight
+          dns_timer_wheel< query_timer > _wheel;
+          /// Ports the queries are spread over, opened with the first query
+          std::vector< udp_port > _ports;
+          /// Size of the pool once it is opened
+          std::size_t _port_count;
+          /// Send over sockets connected to the nameservers
+          bool _connect;
+          /// TCP connections by nameserver, empty until the first truncated answer from it
+          std::vector< shared_tcp_t > _tcp;
+          /// Queries in flight over TCP, the connections read while there are any
+          std::size_t _tcp_queries;
+          /// A TCP connection unused for this long is closed
+          posix_time::time_duration _tcp_idle;
+          /// Closes the idle connections once no queries are in flight over TCP
+          deadline_timer _tcp_timer;
+          /// UDP payload size advertised with EDNS0, 0 sends queries without it
+          uint16_t _edns_payload;
+          /// Queries are encoded here before they are copied into the query
+          dns_buffer_t _encoder;
+          dns_upstreams _upstreams;
+          /// Send every query to every nameserver
+          bool _broadcast;
+          /// Shortest wait before a query is hedged
+          posix_time::time_duration _hedge_floor;
+          /// Most hedged copies per query sent, 0 disables hedging
+          double _hedge_budget;
+          /// Hedged copies that may be sent now, earned by every query at _hedge_budget
+          double _hedge_tokens;
+          /// Bounds of the retransmission timeout
+          posix_time::time_duration _rto_min;
+          posix_time::time_duration _rto_max;
+          /// Time a query gets when the caller doesn't give one
+          posix_time::time_duration _query_deadline;
+          /// Retransmissions a query gets when the caller doesn't give a count
+          unsigned _query_retries;
+          /// Queries in flight, indexed by query ID masked with _id_mask
+          std::vector< query_slot > _queries;
+          std::size_t _id_mask;
+          /// IDs of the queries in flight
+          std::vector< uint16_t > _active;
+          /// IDs of the queries in flight by question_key(), to coalesce identical questions
+          boost::unordered_multimap< std::size_t, uint16_t > _inflight;
+          boost::mutex _resolver_mutex;
+          mutable bool _outstanding_read;
+          boost::mt19937 _rng;
+          posix_time::time_duration _stale_deadline;
+          Cache* _cache;
+
+        public:
+          /*!
+           A resolver on the process wide instance of Cache
+
+           \param ids Size of the query ID table, a power of 2 up to 65536. That many queries
+           can be in flight at once, their IDs are random 16 bit numbers either way.
+           */
+          basic_dns_resolver_impl ( io_service& ios, const std::size_t ids = query_ids ) :
+            _ios(ios), _timer(_ios), _timer_expiry(posix_time::not_a_date_time), _wheel(
+                posix_time::microsec_clock::universal_time()), _ports(), _port_count(( std::min )(( std::max )(
+                    boost::thread::hardware_concurrency(), 1u), 8u)), _connect(false), _tcp(), _tcp_queries(0), _tcp_idle(
+                    posix_time::seconds(5)), _tcp_timer(_ios), _edns_payload(1232), _encoder(), _upstreams(), _broadcast(false), _hedge_floor(posix_time::milliseconds(10)),
+                _hedge_budget(0.05), _hedge_tokens(0.0), _rto_min(posix_time::milliseconds(50)), _rto_max(
+                    posix_time::seconds(5)), _query_deadline(posix_time::seconds(30)), _query_retries(5), _queries(
+                    ids), _id_mask(ids - 1), _active(), _outstanding_read(false), _stale_deadline(posix_time::milliseconds(1800)), _cache(&boost::detail::thread::singleton< Cache >::instance())
+          {
+          }
+
+          /*!
+           A resolver on a cache of its own, ids as above
+           */
+          basic_dns_resolver_impl ( io_service& ios, Cache& cache, const std::size_t ids = query_ids ) :
+            _ios(ios), _timer(_ios), _timer_expiry(posix_time::not_a_date_time), _wheel(
+                posix_time::microsec_clock::universal_time()), _ports(), _port_count(( std::min )(( std::max )(
+                    boost::thread::hardware_concurrency(), 1u), 8u)), _connect(false), _tcp(), _tcp_queries(0), _tcp_idle(
+                    posix_time::seconds(5)), _tcp_timer(_ios), _edns_payload(1232), _encoder(), _upstreams(), _broadcast(false), _hedge_floor(posix_time::milliseconds(10)),
+                _hedge_budget(0.05), _hedge_tokens(0.0), _rto_min(posix_time::milliseconds(50)), _rto_max(
+                    posix_time::seconds(5)), _query_deadline(posix_time::seconds(30)), _query_retries(5), _queries(
+                    ids), _id_mask(ids - 1), _active(), _outstanding_read(false), _stale_deadline(posix_time::milliseconds(1800)), _cache(&cache)
+          {
+          }
+
+          void
+          destroy ()
+          {
+          }
+
+          void
+          add_nameserver ( ip::address addr )
+          {
+            ip::udp::endpoint endpoint(addr, 53);
+            _upstreams.add(endpoint);
+          }
+
+          /*!
+           Number of sockets, each on its own source port, that queries are spread over.
+           One per core up to 8 by default. The sockets are opened with the first query
+           and stay open for the life of the resolver, so changing the count only has an
+           effect before that.
+           */
+          void
+          sockets ( const std::size_t count )
+          {
+            _port_count = ( std::max )(count, std::size_t(1));
+          }
+
+          /*!
+           Sends over UDP sockets connected to the nameservers, one per nameserver and
+           port of the pool. The kernel then skips the route lookup on every send and
+           drops datagrams from anyone but the nameserver. Off by default.
+           */
+          void
+          connected ( const bool enable )
+          {
+            _connect = enable;
+          }
+
+          /*!
+           How long a TCP connection to a nameserver stays open without queries, 5
+           seconds by default. Queries go over TCP after a truncated answer over UDP.
+           The timer that closes the connection keeps the io_service busy until then.
+           */
+          void
+          tcp_idle ( const posix_time::time_duration& idle )
+          {
+            _tcp_idle = idle;
+          }
+
+          /*!
+           UDP payload size advertised in the EDNS0 OPT record of every query, 1232 bytes
+           by default, which fits the 1280 byte IPv6 minimum MTU so answers don't get
+           fragmented. Answers up to that size come back in one datagram instead of
+           truncated at 512 bytes. 0 sends plain queries without EDNS0.
+           */
+          void
+          edns_payload ( const uint16_t payload )
+          {
+            _edns_payload = payload;
+          }
+
+          /*!
+           Sends every query to every nameserver and takes the first answer, instead of
+           picking one nameserver by its round trip time and error rate.
+           */
+          void
+          broadcast ( const bool enable )
+          {
+            _broadcast = enable;
+          }
+
+          /*!
+           Share of the queries sent to a nameserver other than the best one, so the
+           others stay measured. 0.02 by default.
+           */
+          void
+          explore ( const double fraction )
+          {
+            _upstreams.explore(fraction);
+          }
+
+          /*!
+           Hedges queries: when the nameserver hasn't answered by its 95th percentile
+           round trip, or floor if that is longer, the query also goes to the next best
+           nameserver and the first answer wins.
+
+           \param floor Shortest wait before a query is hedged
+           \param budget Most hedged copies per query, 0 disables hedging
+           */
+          void
+          hedge ( const posix_time::time_duration& floor, const double budget )
+          {
+            _hedge_floor = floor;
+            _hedge_budget = budget;
+          }
+
+          /*!
+           Bounds of the retransmission timeout. The timeout of a nameserver follows its
+           round trips as in RFC 6298 and is at least min. Every timeout of the nameserver
+           doubles it until the nameserver answers again, up to max. 50 ms and 5 seconds
+           by default.
+           */
+          void
+          timeouts ( const posix_time::time_duration& min, const posix_time::time_duration& max )
+          {
+            _rto_min = min;
+            _rto_max = max;
+          }
+
+          /*!
+           Deadline and retransmissions of queries whose caller doesn't give them,
+           30 seconds and 5 by default.
+           */
+          void
+          query_limits ( const posix_time::time_duration& deadline, const unsigned retries )
+          {
+            _query_deadline = deadline;
+            _query_retries = retries;
+          }
+
+          /*!
+           What the resolver has seen of its nameservers
+           */
+          const dns_upstreams&
+          upstreams () const
+          {
+            return _upstreams;
+          }
+
+          /*!
+           Ends every query in flight with operation_aborted
+           */
+          void
+          cancel ()
+          {
+            boost::mutex::scoped_lock scopeLock(_resolver_mutex);
+
+            shared_resource_base_t record;
+            while( !_active.empty() )
+            {
+              uint16_t qid(_active.back());
+              complete(id_slot(qid)._query, record, error::operation_aborted);
+              release(qid);
+            }
+          }
+
+          /*!
+           Switches the resolver to another cache, which has to outlive the resolver
+           */
+          void
+          cache ( Cache& c )
+          {
+            _cache = &c;
+          }
+
+          Cache&
+          cache ()
+          {
+            return *_cache;
+          }
+
+          /*!
+           How long a caller waits for an upstream answer before it is answered from stale
+           cache data, if the cache holds any. See basic_dns_cache::serve_stale().
+           */
+          void
+          stale_deadline ( const posix_time::time_duration& deadline )
+          {
+            _stale_deadline = deadline;
+          }
+
+          template<typename CallbackHandler>
+            void
+            async_resolve ( const net::dns::question & question, CallbackHandler handler )
+            {
+              async_resolve(question, _query_deadline, _query_retries, handler);
+            }
+
+          /*!
+           Resolves a question, giving up after deadline or once the query was sent
+           retries more times without an answer, whichever comes first.
+           */
+          template<typename CallbackHandler>
+            void
+            async_resolve (
+                const net::dns::question & question,
+                const posix_time::time_duration& deadline,
+                const unsigned retries,
+                CallbackHandler handler )
+            {
+              negative_t negative;
+              bool refresh;
+              shared_rrset_t rrset = _cache->lookup(question, negative, refresh);
+              if( rrset )
+              {
+                dns_handler< CallbackHandler > caller(handler);
+                invoke_cached(caller, rrset, negative);
+              }
+              else if( _cache->serves_stale() && ( rrset = _cache->lookup_stale(question, negative) ) )
+              {
+                // race the upstream answer against the stale one
+                shared_ptr< stale_race > race(new stale_race(rrset, negative));
+                shared_ptr< deadline_timer > stale(new deadline_timer(_ios, _stale_deadline));
+                dns_handler_base_t caller(new dns_handler< CallbackHandler > (handler));
+                stale->async_wait(boost::bind(&basic_dns_resolver_impl::handle_stale_deadline, this, caller, race,
+                    boost::asio::placeholders::error));
+
+                send_query(question, stale_handler< CallbackHandler > (handler, race, stale, *_cache), deadline, retries);
+              }
+              else
+                send_query(question, handler, deadline, retries);
+
+              if( refresh )
+                send_query(question, prefetch_handler(*_cache, question), _query_deadline, _query_retries);
+            }
+
+          template<typename CallbackHandler>
+            void
+            async_resolve ( const string & domain, const net::dns::type_t rrtype, CallbackHandler handler )
+            {
+              net::dns::question question(domain, rrtype);
+              async_resolve(question, handler);
+            }
+
+          boost::asio::io_service &
+          get_io_service ()
+          {
+            return _ios;
+          }
+
+          rr_list_t
+          resolve ( const net::dns::question & question, boost::system::error_code & ec )
+          {
+            rr_list_t _list;
+            return _list;
+          }
+
+          rr_list_t
+          resolve ( const net::dns::question & question )
+          {
+            shared_rr_list_t _list(new rr_list_t);
+
+            io_service thisIos;
+            // the one query needs neither a full ID table nor a pool of ports
+            scoped_ptr< basic_dns_resolver_impl > thisResolve(new basic_dns_resolver_impl(thisIos, *_cache, blocking_ids));
+            thisResolve->_upstreams = _upstreams;
+            thisResolve->_broadcast = _broadcast;
+            thisResolve->_hedge_floor = _hedge_floor;
+            thisResolve->_hedge_budget = _hedge_budget;
+            thisResolve->_rto_min = _rto_min;
+            thisResolve->_rto_max = _rto_max;
+            thisResolve->_query_deadline = _query_deadline;
+            thisResolve->_query_retries = _query_retries;
+            thisResolve->_port_count = 1;
+            thisResolve->_connect = _connect;
+            // gone with this call, so it keeps no connections open
+            thisResolve->_tcp_idle = posix_time::time_duration();
+            thisResolve->_edns_payload = _edns_payload;
+            thisResolve->_stale_deadline = _stale_deadline;
+
+            thisResolve->async_resolve(question, bind(&basic_dns_resolver_impl::blocking_callback, thisResolve.get(), _list, _1, _2));
+
+            thisIos.run();
+
+            return *_list.get();
+          }
+
+          rr_list_t
+          resolve ( const string & domain, const net::dns::type_t rrtype )
+          {
+            net::dns::question question(domain, rrtype);
+            return resolve(question);
+          }
+
+          rr_list_t
+          resolve ( const string & domain, const net::dns::type_t rrtype, boost::system::error_code & ec )
+          {
+            rr_list_t _list;
+            return _list;
+          }
+
+        private:
+          void
+          invoke_cached ( dns_handler_base& caller, const shared_rrset_t& rrset, const negative_t negative )
+          {
+            if( negative != negative_none )
+            {
+              shared_resource_base_t record;
+              caller.invoke(_ios, record, error::not_found);
+              return;
+            }
+
+            boost::system::error_code callbackError;
+            for( rr_list_t::const_iterator iter = rrset->begin(); iter != rrset->end(); ++iter )
+            {
+              caller.invoke(_ios, ( *iter ), callbackError);
+            }
+          }
+
+          void
+          handle_stale_deadline ( dns_handler_base_t caller, shared_ptr< stale_race > race, const boost::system::error_code& ec )
+          {
+            if( ec || !race->claim(stale_race::stale) )
+              return;
+
+            // the upstream query keeps going and refreshes the cache when it answers
+            _cache->stale_served();
+            invoke_cached(*caller, race->rrset, race->negative);
+          }
+
+          template<typename CallbackHandler>
+            void
+            send_query (
+                const net::dns::question & question,
+                CallbackHandler handler,
+                const posix_time::time_duration& deadline,
+                const unsigned retries )
+            {
+              boost::mutex::scoped_lock scopeLock(_resolver_mutex);
+
+              dns_handler_base_t callback(new dns_handler< CallbackHandler > (handler));
+              posix_time::ptime expires(posix_time::microsec_clock::universal_time() + deadline);
+
+              // the same question is already upstream, wait for its answer. The query gets
+              // the longer deadline and more retries of the two callers.
+              shared_dq_t dq(inflight(question));
+              if( dq )
+              {
+                dq->_callbacks.push_back(callback);
+                dq->_deadline = ( std::max )(dq->_deadline, expires);
+                dq->_retries = ( std::max )(dq->_retries, retries);
+                return;
+              }
+
+              dq = shared_dq_t(new dns_query_t(question, expires, retries));
+              dq->_callbacks.push_back(callback);
+
+              if( !acquire(dq) )
+              {
+                // every query ID is in flight
+                shared_resource_base_t record;
+                callback->invoke(_ios, record, boost::asio::error::no_buffer_space);
+                return;
+              }
+
+              if( _ports.empty() )
+                open_ports();
+
+              // a random port, so an answer has to guess it as well as the ID
+              dq->_port = _rng() % _ports.size();
+              if( !_ports[dq->_port]._queries++ )
+                receive(_ports[dq->_port]);
+
+              encode(dq, _edns_payload);
+              dq->_edns = !dq->_packet.empty();
+              send_request(dq->_question_id, dq->_generation, false);
+            }
+
+          /*!
+           Encodes the query of dq, into its packet with an OPT record advertising payload,
+           or into its plain packet if payload is 0
+           */
+          void
+          encode ( const shared_dq_t& dq, const uint16_t payload )
+          {
+            net::dns::message qmessage(dq->_question);
+
+            // set a few defaults for a message
+            qmessage.recursive(true);
+            qmessage.action(net::dns::message::query);
+            qmessage.opcode(net::dns::message::squery);
+            qmessage.id(dq->_question_id);
+            qmessage.edns(payload);
+            qmessage.encode(_encoder);
+
+            std::vector< uint8_t >& packet(qmessage.is_edns() ? dq->_packet : dq->_plain);
+            packet.assign(_encoder.get_array().data(), _encoder.get_array().data() + _encoder.length());
+          }
+
+          /*!
+           The packet of dq that goes to upstream, without the OPT record to a nameserver
+           that doesn't understand EDNS0
+           */
+          const std::vector< uint8_t >&
+          packet ( const shared_dq_t& dq, const int upstream )
+          {
+            if( dq->_edns && _upstreams[upstream].edns() )
+              return dq->_packet;
+
+            if( dq->_plain.empty() )
+              encode(dq, 0);
+
+            return dq->_plain;
+          }
+
+          /*!
+           Takes a free query ID for dq, probing up from a random one so IDs stay
+           unpredictable. Returns false when all of them are in flight.
+           */
+          bool
+          acquire ( const shared_dq_t& dq )
+          {
+            if( _active.size() == _queries.size() )
+              return false;
+
+            uint16_t id((uint16_t) _rng());
+            while( id_slot(id)._query )
+              ++id;
+
+            query_slot& slot(id_slot(id));
+            slot._query = dq;
+            slot._active = uint32_t(_active.size());
+            _active.push_back(id);
+
+            dq->_question_id = id;
+            dq->_generation = slot._generation;
+            _inflight.insert(std::make_pair(question_key(dq->_question), id));
+            return true;
+          }
+
+          /*!
+           Frees the query ID. A socket with no more queries in flight stops reading,
+           so an io_service with nothing else to do can return.
+           */
+          void
+          release ( const uint16_t id )
+          {
+            query_slot& slot(id_slot(id));
+            if( !slot._query )
+              return;
+
+            typedef typename boost::unordered_multimap< std::size_t, uint16_t >::iterator inflight_iterator_t;
+            std::pair< inflight_iterator_t, inflight_iterator_t > range(_inflight.equal_range(question_key(
+                slot._query->_question)));
+            for( ; range.first != range.second; ++range.first )
+            {
+              if( range.first->second == id )
+              {
+                _inflight.erase(range.first);
+                break;
+              }
+            }
+
+            if( slot._query->_tcp && !--_tcp_queries )
+            {
+              stop_reading_tcp();
+              arm_tcp_idle();
+            }
+
+            udp_port& port(_ports[slot._query->_port]);
+            if( !--port._queries )
+            {
+              stop_reading(*port._socket);
+              for( std::size_t i = 0; i < port._connected.size(); ++i )
+              {
+                if( port._connected[i] )
+                  stop_reading(*port._connected[i]);
+              }
+            }
+
+            slot._query.reset();
+            ++slot._generation;
+
+            uint16_t last(_active.back());
+            _active[slot._active] = last;
+            id_slot(last)._active = slot._active;
+            _active.pop_back();
+
+            // nothing in flight, so whatever is left on the wheel is stale
+            if( _active.empty() )
+            {
+              _wheel.clear();
+              _timer.cancel();
+              _timer_expiry = posix_time::ptime(posix_time::not_a_date_time);
+            }
+          }
+
+          /*!
+           The query in flight for question, empty if there is none
+           */
+          shared_dq_t
+          inflight ( const net::dns::question& question ) const
+          {
+            typedef typename boost::unordered_multimap< std::size_t, uint16_t >::const_iterator inflight_iterator_t;
+            std::pair< inflight_iterator_t, inflight_iterator_t > range(_inflight.equal_range(question_key(question)));
+            for( ; range.first != range.second; ++range.first )
+            {
+              const shared_dq_t& dq(id_slot(range.first->second)._query);
+              if( same_question(dq->_question, question) )
+                return dq;
+            }
+
+            return shared_dq_t();
+          }
+
+          /*!
+           Hands record to every caller waiting for dq
+           */
+          void
+          complete ( const shared_dq_t& dq, const shared_resource_base_t& record, const boost::system::error_code& ec )
+          {
+            for( typename std::vector< dns_handler_base_t >::iterator iter = dq->_callbacks.begin(); iter
+                != dq->_callbacks.end(); ++iter )
+              ( *iter )->invoke(_ios, record, ec);
+          }
+
+          query_slot&
+          id_slot ( const uint16_t id )
+          {
+            return _queries[id & _id_mask];
+          }
+
+          const query_slot&
+          id_slot ( const uint16_t id ) const
+          {
+            return _queries[id & _id_mask];
+          }
+
+          /*!
+           The query in flight on id, empty if the query of that generation is done
+           */
+          shared_dq_t
+          pending ( const uint16_t id, const uint32_t generation ) const
+          {
+            const query_slot& slot(id_slot(id));
+            if( slot._generation != generation )
+              return shared_dq_t();
+
+            return slot._query;
+          }
+
+          /*!
+           Sends the query on id, unless it finished in the meantime, and starts its
+           retransmission timer. A retry counts against the nameserver that didn't
+           answer, and goes to another one if there is one.
+           */
+          void
+          send_request ( const uint16_t id, const uint32_t generation, const bool retry )
+          {
+            shared_dq_t dq(pending(id, generation));
+            if( !dq )
+              return;
+
+            posix_time::ptime now(posix_time::microsec_clock::universal_time());
+            ++dq->_tries;
+            dq->_sent = now;
+
+            if( _broadcast )
+            {
+              // the first answer wins, so the fastest nameserver sets the pace
+              posix_time::time_duration timeout(_rto_max);
+              dq->_upstream = dns_upstreams::none;
+              for( std::size_t i = 0; i < _upstreams.size(); ++i )
+              {
+                if( retry )
+                  _upstreams[i].timed_out();
+
+                transmit(dq, int(i));
+                timeout = ( std::min )(timeout, rto(dq, int(i)));
+              }
+
+              arm_retry(dq, timeout);
+              return;
+            }
+
+            if( retry && dq->_upstream != dns_upstreams::none )
+              _upstreams[dq->_upstream].timed_out();
+
+            dq->_upstream = _upstreams.select(dq->_upstream);
+            if( dq->_upstream == dns_upstreams::none )
+            {
+              // no nameservers, the query can only run into its deadline
+              arm_retry(dq, _rto_max);
+              return;
+            }
+
+            transmit(dq, dq->_upstream);
+            arm_retry(dq, rto(dq, dq->_upstream));
+
+            if( !retry )
+              arm_hedge(dq);
+          }
+
+          /*!
+           The answer didn't fit into a datagram, asks the nameserver again over TCP
+           */
+          void
+          retry_tcp ( const shared_dq_t& dq, const int upstream )
+          {
+            dq->_tcp = true;
+            ++_tcp_queries;
+
+            dq->_upstream = ( upstream != dns_upstreams::none ) ? upstream : _upstreams.select();
+            if( dq->_upstream == dns_upstreams::none )
+            {
+              // no nameservers, the query can only run into its deadline
+              arm_retry(dq, _rto_max);
+              return;
+            }
+
+            ++dq->_tries;
+            dq->_sent = posix_time::microsec_clock::universal_time();
+            transmit(dq, dq->_upstream);
+            arm_retry(dq, rto(dq, dq->_upstream));
+          }
+
+          /*!
+           Retransmission timeout of dq at a nameserver, doubled over TCP for the handshake
+           */
+          posix_time::time_duration
+          rto ( const shared_dq_t& dq, const int upstream ) const
+          {
+            posix_time::time_duration timeout(_upstreams[upstream].rto(_rto_min, _rto_max));
+            if( dq->_tcp )
+              timeout = ( std::min )(timeout * 2, _rto_max);
+
+            return timeout;
+          }
+
+          /*!
+           Starts the retransmission timer of a query that was just sent, never past the
+           query's deadline. The timeout doubles with every retry through the backoff of
+           the nameservers that didn't answer.
+           */
+          void
+          arm_retry ( const shared_dq_t& dq, const posix_time::time_duration& rto )
+          {
+            posix_time::time_duration timeout(rto);
+            posix_time::time_duration left(dq->_deadline - dq->_sent);
+            if( timeout > left )
+              timeout = left;
+
+            schedule(dq->_sent + timeout, query_timer(query_timer::retry, dq->_question_id, dq->_generation, dq->_tries));
+          }
+
+          /*!
+           The query went unanswered for its timeout: send it again, or time it out when
+           it ran out of retries or time.
+           */
+          void
+          retry ( const query_timer& timer )
+          {
+            shared_dq_t dq(pending(timer._id, timer._generation));
+            if( !dq || dq->_tries != timer._tries )
+              return;
+
+            const uint16_t id(timer._id);
+            const uint32_t generation(timer._generation);
+
+            if( dq->_tries > dq->_retries || posix_time::microsec_clock::universal_time() >= dq->_deadline )
+            {
+              if( dq->_upstream != dns_upstreams::none )
+                _upstreams[dq->_upstream].timed_out();
+
+              shared_resource_base_t record;
+              complete(dq, record, error::timed_out);
+              release(id);
+              return;
+            }
+
+            send_request(id, generation, true);
+          }
+
+          /*!
+           A nameserver answered SERVFAIL or REFUSED, which another one may well answer.
+           A hedged query waits for its other copy, a broadcast one for the other
+           nameservers until every one of them turned it down. Otherwise the query goes to the next best nameserver while it has
+           retries and time left.
+
+           \return True if the query goes on, false if the failure goes to the callers
+           */
+          bool
+          retry_failed ( const shared_dq_t& dq, const int upstream )
+          {
+            if( dq->_hedge_upstream != dns_upstreams::none )
+            {
+              // the copy that is left goes on as the query
+              if( upstream != dq->_hedge_upstream )
+              {
+                dq->_upstream = dq->_hedge_upstream;
+                dq->_sent = dq->_hedge_sent;
+              }
+
+              dq->_hedge_upstream = dns_upstreams::none;
+              return true;
+            }
+
+            if( _upstreams.size() < 2 )
+              return false;
+
+            if( _broadcast )
+            {
+              // a sender that isn't one of the nameservers doesn't count
+              if( upstream == dns_upstreams::none )
+                return true;
+
+              dq->_failed.resize(_upstreams.size());
+              if( !dq->_failed[upstream] )
+              {
+                dq->_failed[upstream] = true;
+                ++dq->_failures;
+              }
 
-namespace boost
-{
-  namespace net
-  {
-    namespace dns
-    {
+              return dq->_failures < _upstreams.size();
+            }
 
-      /// Single instance of the dns cache
-      typedef boost::detail::thread::singleton< net::dns::dns_cache_t > dns_cache_object;
+            if( dq->_tries > dq->_retries || posix_time::microsec_clock::universal_time() >= dq->_deadline )
+              return false;
 
-      class dns_resolver_impl
-      {
-      private:
-        /// Outbound DNS request buffer
-        typedef vector< ip::udp::endpoint > ep_vector_t;
+            send_request(dq->_question_id, dq->_generation, false);
+            return true;
+          }
 
-        class dns_handler_base
-        {
-        public:
-          dns_handler_base ()
+          /*!
+           Starts the hedge timer of a query that was just sent, at the 95th percentile
+           round trip of its nameserver or the floor, whichever is longer.
+           */
+          void
+          arm_hedge ( const shared_dq_t& dq )
           {
+            if( _hedge_budget <= 0.0 || _upstreams.size() < 2 )
+              return;
+
+            // every query earns a share of a hedge, a few may be saved up for a burst of slow answers
+            _hedge_tokens = ( std::min )(_hedge_tokens + _hedge_budget, 10.0);
+
+            posix_time::time_duration delay(posix_time::microseconds(( boost::int64_t ) _upstreams[dq->_upstream].p95()));
+            if( delay < _hedge_floor )
+              delay = _hedge_floor;
+
+            schedule(dq->_sent + delay, query_timer(query_timer::hedge, dq->_question_id, dq->_generation, dq->_tries));
           }
 
-          virtual
-          ~dns_handler_base ()
+          /*!
+           The query is slow, send a copy to the next best nameserver if the budget allows
+           */
+          void
+          send_hedge ( const query_timer& timer )
           {
+            shared_dq_t dq(pending(timer._id, timer._generation));
+            if( !dq || dq->_tries != timer._tries || dq->_hedge_upstream != dns_upstreams::none || _hedge_tokens < 1.0 )
+              return;
+
+            int upstream(_upstreams.select(dq->_upstream));
+            if( upstream == dns_upstreams::none || upstream == dq->_upstream )
+              return;
+
+            _hedge_tokens -= 1.0;
+            dq->_hedge_upstream = upstream;
+            dq->_hedge_sent = posix_time::microsec_clock::universal_time();
+            transmit(dq, upstream);
           }
 
-          virtual void
-          invoke ( io_service& ios, const shared_resource_base_t& record, const boost::system::error_code& ec )
+          /*!
+           Puts a timer on the wheel, and brings _timer forward if it fires first
+           */
+          void
+          schedule ( const posix_time::ptime& when, const query_timer& timer )
           {
+            posix_time::ptime expiry(_wheel.schedule(when, timer));
+            if( _timer_expiry.is_not_a_date_time() || expiry < _timer_expiry )
+              arm_timer(expiry);
           }
-        };
 
-        typedef shared_ptr< dns_handler_base > dns_handler_base_t;
+          void
+          arm_timer ( const posix_time::ptime& expiry )
+          {
+            _timer_expiry = expiry;
+            _timer.expires_at(expiry);
+            _timer.async_wait(boost::bind(&basic_dns_resolver_impl::handle_timer, this, boost::asio::placeholders::error));
+          }
 
-        /// Handler to wrap asynchronous callback function
-        template<typename Handler>
-          class dns_handler : public dns_handler_base
+          /*!
+           Runs the timers that are due, and sets _timer for the next ones
+           */
+          void
+          handle_timer ( const boost::system::error_code& ec )
           {
-          public:
-            dns_handler ( Handler h ) :
-              dns_handler_base(), handler_(h)
+            // moved to an earlier expiry
+            if( ec == boost::asio::error::operation_aborted )
+              return;
+
+            boost::mutex::scoped_lock scopeLock(_resolver_mutex);
+
+            std::vector< query_timer > due;
+            _timer_expiry = posix_time::ptime(posix_time::not_a_date_time);
+            _wheel.expire(posix_time::microsec_clock::universal_time(), due);
+
+            for( typename std::vector< query_timer >::const_iterator iter = due.begin(); iter != due.end(); ++iter )
             {
+              if( iter->_kind == query_timer::retry )
+                retry(*iter);
+              else
+                send_hedge(*iter);
             }
 
-            virtual
-            ~dns_handler ()
+            posix_time::ptime next(_wheel.next_expiry());
+            if( !next.is_not_a_date_time() && ( _timer_expiry.is_not_a_date_time() || next < _timer_expiry ) )
+              arm_timer(next);
+          }
+
+          /*!
+           Opens the pool, every port with a socket on an ephemeral port of its own
+           */
+          void
+          open_ports ()
+          {
+            _ports.resize(_port_count);
+            for( std::size_t i = 0; i < _ports.size(); ++i )
             {
+              _ports[i]._socket.reset(new udp_channel(_ios, i, dns_upstreams::none));
+              _ports[i]._socket->_socket.open(ip::udp::v4());
+              _ports[i]._socket->_socket.bind(ip::udp::endpoint(ip::udp::v4(), 0));
             }
+          }
 
-            virtual void
-            invoke ( io_service& ios, const shared_resource_base_t& record, const boost::system::error_code& ec )
+          /*!
+           The socket of port connected to upstream, connected on first use
+           */
+          udp_channel&
+          connected ( udp_port& port, const int upstream )
+          {
+            if( port._connected.size() <= std::size_t(upstream) )
+              port._connected.resize(upstream + 1);
+
+            shared_channel_t& channel(port._connected[upstream]);
+            if( !channel )
             {
-              ios.post(boost::asio::detail::bind_handler(handler_, record, ec));
+              channel.reset(new udp_channel(_ios, port._socket->_port, upstream));
+              channel->_socket.open(ip::udp::v4());
+              channel->_socket.connect(_upstreams[upstream].endpoint());
             }
 
-          private:
-            Handler handler_;
-          };
+            if( port._queries && !channel->_receiving )
+              receive(channel);
 
-        /*!
-         DNS Query structure
-         */
-        struct dns_query_t
-        {
-          dns_query_t ( const net::dns::question& q ) :
-            _query_start(posix_time::second_clock::local_time(), posix_time::seconds(30)), _query_sent(
-                posix_time::second_clock::local_time(),
-                posix_time::seconds(2))
+            return *channel;
+          }
+
+          /*!
+           Starts reading on every socket of port
+           */
+          void
+          receive ( udp_port& port )
           {
-            _question = q;
-            //      _qbuffer = shared_ptr<net::network_buffer_t>(new net::network_buffer_t(_mbuffer.data(), _mbuffer.size()));
+            if( !port._socket->_receiving )
+              receive(port._socket);
+
+            for( std::size_t i = 0; i < port._connected.size(); ++i )
+            {
+              if( port._connected[i] && !port._connected[i]->_receiving )
+                receive(port._connected[i]);
+            }
           }
 
-          dns_query_t ( const dns_query_t& o ) :
-            _query_start(posix_time::time_period(o._query_start.begin(), o._query_start.last())), _query_sent(
-                posix_time::time_period(o._query_sent.begin(), o._query_sent.last()))
+          void
+          receive ( const shared_channel_t& channel )
           {
-            operator=(o);
+            channel->_receiving = true;
+            channel->_socket.async_receive_from(boost::asio::buffer(channel->_buffer->get_array().data(),
+                channel->_buffer->get_array().size()), channel->_sender, boost::bind(
+                &basic_dns_resolver_impl::handle_recv,
+                this,
+                channel,
+                boost::asio::placeholders::error,
+                boost::asio::placeholders::bytes_transferred));
           }
 
-          virtual
-          ~dns_query_t ()
+          /// Stops reading on a socket whose port has nothing in flight
+          static void
+          stop_reading ( udp_channel& channel )
           {
+            if( channel._receiving )
+              channel._socket.cancel();
           }
 
-          const dns_query_t&
-          operator= ( const dns_query_t& o )
+          /*!
+           Sends the query to a nameserver, over TCP once it got a truncated answer. The
+           packets are encoded once, retransmissions and hedged copies send them again.
+           */
+          void
+          transmit ( const shared_dq_t& dq, const int upstream )
           {
-            _question_id = o._question_id;
-            _dns = o._dns;
-            _mbuffer = o._mbuffer;
-            //    _qbuffer = o._qbuffer;
-            _question = o._question;
-            _completion_callback = o._completion_callback;
-            _query_start = posix_time::time_period(o._query_start.begin(), o._query_start.last());
-            _query_sent = posix_time::time_period(o._query_sent.begin(), o._query_sent.last());
-            return *this;
+            if( dq->_tcp )
+              send_tcp(dq, upstream, packet(dq, upstream));
+            else
+              send_to(dq, upstream, packet(dq, upstream));
           }
 
-          /// Question ID
-          uint16_t _question_id;
+          /*!
+           The connection to upstream, a new one if there is none or it sat idle too long
+           */
+          shared_tcp_t
+          tcp ( const int upstream )
+          {
+            if( _tcp.size() <= std::size_t(upstream) )
+              _tcp.resize(upstream + 1);
+
+            posix_time::ptime now(posix_time::microsec_clock::universal_time());
+            if( _tcp[upstream] && now - _tcp[upstream]->_used > _tcp_idle )
+              close_tcp(_tcp[upstream]);
+
+            if( !_tcp[upstream] )
+            {
+              shared_tcp_t connection(new tcp_connection(_ios, upstream));
+              connection->_used = now;
+              _tcp[upstream] = connection;
 
-          /// Domain Name Server Address to send request to
-          ip::udp::endpoint _dns;
+              const ip::udp::endpoint& endpoint(_upstreams[upstream].endpoint());
+              connection->_socket.async_connect(ip::tcp::endpoint(endpoint.address(), endpoint.port()), boost::bind(
+                  &basic_dns_resolver_impl::handle_connect,
+                  this,
+                  connection,
+                  boost::asio::placeholders::error));
+            }
 
-          /// DNS Query Buffer
-          dns_buffer_t _mbuffer;
-          //    shared_dns_buffer_t   _qbuffer;
+            return _tcp[upstream];
+          }
 
-          /// DNS Query question
-          net::dns::question _question;
+          /*!
+           Queues the query on the connection to upstream, behind any others
+           */
+          void
+          send_tcp ( const shared_dq_t& dq, const int upstream, const std::vector< uint8_t >& query )
+          {
+            shared_tcp_t connection(tcp(upstream));
 
-          /// DNS Completion handler
-          dns_handler_base_t _completion_callback;
+            shared_ptr< std::vector< uint8_t > > packet(new std::vector< uint8_t >(2));
+            ( *packet )[0] = uint8_t(query.size() >> 8);
+            ( *packet )[1] = uint8_t(query.size() & 0xff);
+            packet->insert(packet->end(), query.begin(), query.end());
 
-          /// Time period the request is good for
-          posix_time::time_period _query_start;
+            connection->_writes.push_back(packet);
+            connection->_used = posix_time::microsec_clock::universal_time();
 
-          /// Time period which the last request was sent
-          posix_time::time_period _query_sent;
+            if( connection->_open )
+            {
+              write_tcp(connection);
+              if( !connection->_reading )
+                read_tcp(connection);
+            }
+          }
 
+          /// False once the connection was closed or replaced
           bool
-          operator< ( const uint16_t& id ) const
+          current ( const shared_tcp_t& connection ) const
           {
-            return _question_id < id;
+            return std::size_t(connection->_upstream) < _tcp.size() && _tcp[connection->_upstream] == connection;
           }
 
-          bool
-          expired () const
+          void
+          close_tcp ( const shared_tcp_t& connection )
           {
-            posix_time::ptime nowTime = posix_time::second_clock::local_time();
-            return !_query_start.contains(nowTime);
+            boost::system::error_code ignored;
+            connection->_socket.close(ignored);
+
+            if( current(connection) )
+              _tcp[connection->_upstream].reset();
           }
 
-          bool
-          resend () const
+          /// Closes the connections that have been idle for longer than _tcp_idle
+          void
+          close_idle ()
           {
-            posix_time::ptime nowTime = posix_time::second_clock::local_time();
-            return _query_sent.contains(nowTime);
+            posix_time::ptime now(posix_time::microsec_clock::universal_time());
+            for( std::size_t i = 0; i < _tcp.size(); ++i )
+            {
+              if( _tcp[i] && now - _tcp[i]->_used >= _tcp_idle )
+                close_tcp(_tcp[i]);
+            }
           }
-        };
 
-        typedef shared_ptr< dns_query_t > shared_dq_t;
+          /*!
+           Sets _tcp_timer for the connection that goes idle first, if there are any
+           */
+          void
+          arm_tcp_idle ()
+          {
+            posix_time::ptime expiry(posix_time::not_a_date_time);
+            for( std::size_t i = 0; i < _tcp.size(); ++i )
+            {
+              if( _tcp[i] && ( expiry.is_not_a_date_time() || _tcp[i]->_used + _tcp_idle < expiry ) )
+                expiry = _tcp[i]->_used + _tcp_idle;
+            }
 
-        struct by_question_id
-        {
-        };
-        struct by_expired
-        {
-        };
-        struct by_resend
-        {
-        };
-#if !defined(GENERATING_DOCUMENTATION)
-        typedef multi_index_container< shared_dq_t, indexed_by< ordered_non_unique< tag< by_resend > , const_mem_fun<
-            dns_query_t, bool, &dns_query_t::resend > > , ordered_non_unique< tag< by_expired > , const_mem_fun<
-            dns_query_t, bool, &dns_query_t::expired > > , ordered_non_unique< tag< by_question_id > , member<
-            dns_query_t, uint16_t, &dns_query_t::_question_id > > > > query_container_t;
-#endif
-        typedef query_container_t::index< by_question_id >::type::iterator question_id_iterator_t;
-        typedef query_container_t::index< by_expired >::type::iterator expired_iterator_t;
-        typedef query_container_t::index< by_resend >::type::iterator resend_iterator_t;
-
-        io_service& _ios;
-        deadline_timer _timer;
-        ip::udp::socket _socket;
-        ep_vector_t _dnsList;
-        query_container_t _query_list;
-        boost::mutex _resolver_mutex;
-        mutable bool _outstanding_read;
-        boost::mt19937 _rng;
-
-      public:
-        dns_resolver_impl ( io_service& ios ) :
-          _ios(ios), _timer(_ios), _socket(_ios), _outstanding_read(false)
-        {
-        }
+            if( expiry.is_not_a_date_time() )
+              return;
 
-        void
-        destroy ()
-        {
-        }
+            _tcp_timer.expires_at(expiry);
+            _tcp_timer.async_wait(boost::bind(&basic_dns_resolver_impl::handle_tcp_idle, this,
+                boost::asio::placeholders::error));
+          }
 
-        void
-        add_nameserver ( ip::address addr )
-        {
-          ip::udp::endpoint endpoint(addr, 53);
-          _dnsList.push_back(endpoint);
-        }
+          void
+          handle_tcp_idle ( const boost::system::error_code& ec )
+          {
+            if( ec == boost::asio::error::operation_aborted )
+              return;
 
-        void
-        cancel ()
-        {
-          _socket.cancel();
-        }
+            boost::mutex::scoped_lock scopeLock(_resolver_mutex);
+
+            // a connection in use is looked at again once its queries are done
+            if( _tcp_queries )
+              return;
+
+            close_idle();
+            arm_tcp_idle();
+          }
 
-        template<typename CallbackHandler>
+          /*!
+           Stops reading on the connections once no query is waiting for an answer over
+           TCP, so an io_service with nothing else to do can return. The connections stay
+           open. A connection still writing stops once its writes are done, as cancelling
+           would abort them too.
+           */
           void
-          async_resolve ( const net::dns::question & question, CallbackHandler handler )
+          stop_reading_tcp ()
           {
-            if( dns_cache_object::instance().exists(question) )
+            for( std::size_t i = 0; i < _tcp.size(); ++i )
             {
-              boost::system::error_code callbackError;
-              dns_handler< CallbackHandler > caller(handler);
-
-              rr_list_t record_list = dns_cache_object::instance().get(question);
-              for( rr_list_t::iterator iter = record_list.begin(); iter != record_list.end(); ++iter )
-              {
-                caller.invoke(_ios, ( *iter ), callbackError);
-              }
+              if( _tcp[i] && _tcp[i]->_reading && !_tcp[i]->_writing )
+                _tcp[i]->_socket.cancel();
             }
-            else
-            {
-              boost::mutex::scoped_lock scopeLock(_resolver_mutex);
-              if( !_socket.is_open() )
-              {
-                _socket.open(ip::udp::v4());
-                _socket.bind(ip::udp::endpoint(ip::udp::v4(), 0));
-              }
+          }
+
+          void
+          handle_connect ( shared_tcp_t connection, const boost::system::error_code& ec )
+          {
+            boost::mutex::scoped_lock scopeLock(_resolver_mutex);
 
-              _timer.expires_from_now(posix_time::seconds(2));
-              _timer.async_wait(boost::bind(&dns_resolver_impl::handle_timeout, this, boost::asio::placeholders::error));
+            if( !current(connection) )
+              return;
 
-              net::dns::message qmessage(question);
+            // the queries on it are retried when their timers run out
+            if( ec )
+            {
+              close_tcp(connection);
+              return;
+            }
 
-              // set a few defaults for a message
-              qmessage.recursive(true);
-              qmessage.action(net::dns::message::query);
-              qmessage.opcode(net::dns::message::squery);
+            connection->_open = true;
+            write_tcp(connection);
+            if( _tcp_queries )
+              read_tcp(connection);
+          }
 
-              // make our message id unique
-              uint16_t quid((uint16_t) _rng());
+          void
+          write_tcp ( const shared_tcp_t& connection )
+          {
+            if( connection->_writing || connection->_writes.empty() )
+              return;
 
-              for( ep_vector_t::iterator iter = _dnsList.begin(); iter != _dnsList.end(); ++iter )
-              {
-                shared_dq_t dq = shared_dq_t(new dns_query_t(question));
+            connection->_writing = true;
+            boost::asio::async_write(connection->_socket, boost::asio::buffer(*connection->_writes.front()), boost::bind(
+                &basic_dns_resolver_impl::handle_tcp_write,
+                this,
+                connection,
+                boost::asio::placeholders::error));
+          }
 
-                dq->_question_id = (uint16_t) quid;
-                dq->_dns = *iter;
-                dq->_completion_callback = shared_ptr< dns_handler< CallbackHandler > > (new dns_handler<
-                    CallbackHandler > (handler));
+          void
+          handle_tcp_write ( shared_tcp_t connection, const boost::system::error_code& ec )
+          {
+            boost::mutex::scoped_lock scopeLock(_resolver_mutex);
 
-                qmessage.id(dq->_question_id);
-                qmessage.encode(dq->_mbuffer);
+            connection->_writing = false;
+            if( !current(connection) )
+              return;
 
-                _query_list.insert(dq);
-                send_request(dq);
-              }
+            if( ec )
+            {
+              close_tcp(connection);
+              return;
             }
+
+            connection->_writes.pop_front();
+            write_tcp(connection);
+
+            if( !connection->_writing && connection->_reading && !_tcp_queries )
+              connection->_socket.cancel();
           }
 
-        template<typename CallbackHandler>
           void
-          async_resolve ( const string & domain, const net::dns::type_t rrtype, CallbackHandler handler )
+          read_tcp ( const shared_tcp_t& connection )
           {
-            net::dns::question question(domain, rrtype);
-            async_resolve(question, handler);
+            connection->_reading = true;
+            boost::asio::async_read(connection->_socket, boost::asio::buffer(connection->_length), boost::bind(
+                &basic_dns_resolver_impl::handle_tcp_length,
+                this,
+                connection,
+                boost::asio::placeholders::error,
+                boost::asio::placeholders::bytes_transferred));
           }
 
-        boost::asio::io_service &
-        get_io_service ()
-        {
-          return _ios;
-        }
+          void
+          handle_tcp_length ( shared_tcp_t connection, const boost::system::error_code& ec, std::size_t bytes_transferred )
+          {
+            boost::mutex::scoped_lock scopeLock(_resolver_mutex);
 
-        rr_list_t
-        resolve ( const net::dns::question & question, boost::system::error_code & ec )
-        {
-          rr_list_t _list;
-          return _list;
-        }
+            connection->_reading = false;
+            if( !current(connection) )
+              return;
 
-        rr_list_t
-        resolve ( const net::dns::question & question )
-        {
-          shared_rr_list_t _list(new rr_list_t);
+            if( ec )
+            {
+              // stopped between two messages, the connection is still good
+              if( ec != boost::asio::error::operation_aborted || bytes_transferred )
+                close_tcp(connection);
 
-          io_service thisIos;
-          dns_resolver_impl thisResolve(thisIos);
-          thisResolve._dnsList = _dnsList;
+              if( current(connection) && _tcp_queries )
+                read_tcp(connection);
 
-          thisResolve.async_resolve(question, bind(&dns_resolver_impl::blocking_callback, &thisResolve, _list, _1, _2));
+              return;
+            }
 
-          thisIos.run();
+            std::size_t length(( std::size_t(connection->_length[0]) << 8 ) | connection->_length[1]);
+            if( !length )
+            {
+              close_tcp(connection);
+              return;
+            }
 
-          return *_list.get();
-        }
+            connection->_reading = true;
+            boost::asio::async_read(connection->_socket, boost::asio::buffer(connection->_buffer->get_array().data(),
+                length), boost::bind(
+                &basic_dns_resolver_impl::handle_tcp_read,
+                this,
+                connection,
+                boost::asio::placeholders::error,
+                boost::asio::placeholders::bytes_transferred));
+          }
 
-        rr_list_t
-        resolve ( const string & domain, const net::dns::type_t rrtype )
-        {
-          net::dns::question question(domain, rrtype);
-          return resolve(question);
-        }
+          void
+          handle_tcp_read ( shared_tcp_t connection, const boost::system::error_code& ec, std::size_t bytes_transferred )
+          {
+            boost::mutex::scoped_lock scopeLock(_resolver_mutex);
 
-        rr_list_t
-        resolve ( const string & domain, const net::dns::type_t rrtype, boost::system::error_code & ec )
-        {
-          rr_list_t _list;
-          return _list;
-        }
+            connection->_reading = false;
+            if( !current(connection) )
+              return;
 
-      private:
-        void
-        send ()
-        {
-          boost::mutex::scoped_lock scopeLock(_resolver_mutex);
+            // a message cut short leaves the stream out of step
+            if( ec )
+            {
+              close_tcp(connection);
+              return;
+            }
 
-          question_id_iterator_t iter;
-          for( iter = _query_list.get< by_question_id > ().begin(); iter != _query_list.get< by_question_id > ().end(); ++iter )
-          {
-            _ios.post(bind(&dns_resolver_impl::send_request, this, ( *iter )));
+            connection->_used = posix_time::microsec_clock::universal_time();
+            answer(*connection->_buffer, bytes_transferred, connection->_upstream, 0);
+
+            if( current(connection) && _tcp_queries && !connection->_reading )
+              read_tcp(connection);
           }
-        }
 
-        void
-        send_request ( shared_dq_t& dq )
-        {
-          //    cout << "send_request: " << dq->_dns.address().to_string() << endl;
-          _socket.async_send_to(
-              boost::asio::buffer(dq->_mbuffer.get_array().data(), dq->_mbuffer.length()),
-              dq->_dns,
-              boost::bind(
-                  &dns_resolver_impl::handle_send,
+          /*!
+           Sends packet, one of the query's own, to a nameserver from the query's port
+           */
+          void
+          send_to ( const shared_dq_t& dq, const int upstream, const std::vector< uint8_t >& packet )
+          {
+            udp_port& port(_ports[dq->_port]);
+            if( _connect )
+            {
+              connected(port, upstream)._socket.async_send(boost::asio::buffer(packet), boost::bind(
+                  &basic_dns_resolver_impl::handle_send,
                   this,
                   dq,
                   boost::asio::placeholders::error,
                   boost::asio::placeholders::bytes_transferred));
-        }
+              return;
+            }
 
-        void
-        handle_send ( shared_dq_t& dq, const boost::system::error_code& ec, size_t bytes_sent )
-        {
-          if( !ec || ec == boost::asio::error::message_size )
-          {
-            shared_dns_buffer_t rbuffer(new dns_buffer_t);
+            port._socket->_socket.async_send_to(
+                boost::asio::buffer(packet),
+                _upstreams[upstream].endpoint(),
+                boost::bind(
+                    &basic_dns_resolver_impl::handle_send,
+                    this,
+                    dq,
+                    boost::asio::placeholders::error,
+                    boost::asio::placeholders::bytes_transferred));
+          }
 
-            _socket.async_receive(boost::asio::buffer(rbuffer->get_array().data(), rbuffer->get_array().size()), boost::bind(
-                &dns_resolver_impl::handle_recv,
-                this,
-                rbuffer,
-                boost::asio::placeholders::error,
-                boost::asio::placeholders::bytes_transferred));
+          /*!
+           Holds on to the query until its buffer is sent, the answer comes in through
+           the receive loop of the socket
+           */
+          void
+          handle_send ( shared_dq_t dq, const boost::system::error_code& ec, size_t bytes_sent )
+          {
           }
-        }
 
-        void
-        handle_recv ( shared_dns_buffer_t inBuffer, const boost::system::error_code& ec, std::size_t bytes_transferred )
-        {
-          boost::mutex::scoped_lock scopeLock(_resolver_mutex);
-          _outstanding_read = false;
+          void
+          handle_recv ( shared_channel_t channel, const boost::system::error_code& ec, std::size_t bytes_transferred )
+          {
+            boost::mutex::scoped_lock scopeLock(_resolver_mutex);
+            _outstanding_read = false;
+
+            channel->_receiving = false;
+
+            // a connected socket only hears from its nameserver
+            if( !ec && bytes_transferred )
+              answer(*channel->_buffer, bytes_transferred, ( channel->_upstream != dns_upstreams::none )
+                  ? channel->_upstream : _upstreams.find(channel->_sender), channel.get());
+
+            // keep reading while there are queries on the port, also after a cancel
+            // that raced with a new query
+            if( _ports[channel->_port]._queries && !channel->_receiving )
+              receive(channel);
+          }
 
-          if( !ec && bytes_transferred ) // || ec == boost::asio::error::message_size)
+          /*!
+           Handles a message from upstream, none if it isn't one of ours. The channel
+           it came in on, 0 over TCP.
+           */
+          void
+          answer ( dns_buffer_t& inBuffer, const std::size_t bytes_transferred, const int upstream, const udp_channel* channel )
           {
-            inBuffer.get()->length(bytes_transferred);
+            inBuffer.length(bytes_transferred);
 
             net::dns::message tmpMessage;
 
             uint16_t qid;
-            inBuffer.get()->get(qid);
+            inBuffer.get(qid, 0);
+
+            shared_dq_t dq(id_slot(qid)._query);
+            if( !dq || dq->_question_id != qid || ( channel ? dq->_port != channel->_port : !dq->_tcp ) )
+              return;
+
+            tmpMessage.decode(inBuffer);
+
+            // a late answer to an earlier query on the same ID
+            if( tmpMessage.questions()->empty() || !same_question(tmpMessage.questions()->front(), dq->_question) )
+              return;
+
+            if( upstream != dns_upstreams::none )
+            {
+              posix_time::ptime now(posix_time::microsec_clock::universal_time());
+
+              if( tmpMessage.result() == net::dns::message::server_error || tmpMessage.result()
+                  == net::dns::message::refused )
+                _upstreams[upstream].failed();
+              else if( upstream == dq->_hedge_upstream )
+                _upstreams[upstream].answered(now - dq->_hedge_sent);
+              else if( dq->_tries == 1 )
+                _upstreams[upstream].answered(now - dq->_sent);
+              else
+                // which of the sends this answers is anyone's guess, so it isn't timed
+                _upstreams[upstream].succeeded();
+            }
+
+            // a nameserver that doesn't know EDNS0 answers FORMERR without an OPT
+            // record, ask again without one as RFC 6891 section 7 says
+            if( dq->_edns && ( upstream == dns_upstreams::none || _upstreams[upstream].edns() ) && tmpMessage.result()
+                == net::dns::message::format_error && !tmpMessage.is_edns() )
+            {
+              if( upstream != dns_upstreams::none )
+                _upstreams[upstream].edns_failed();
 
-            std::pair< question_id_iterator_t, question_id_iterator_t > range_iter;
-            range_iter = _query_list.get< by_question_id > ().equal_range(qid);
-            if( range_iter.first == range_iter.second )
+              dq->_edns = false;
+              send_request(dq->_question_id, dq->_generation, false);
               return;
+            }
+
+            bool failed(tmpMessage.result() == net::dns::message::server_error || tmpMessage.result()
+                == net::dns::message::refused);
+            if( failed && retry_failed(dq, upstream) )
+              return;
+
+            if( channel && tmpMessage.is_truncated() )
+            {
+              if( !dq->_tcp )
+                retry_tcp(dq, upstream);
 
-            question_id_iterator_t qiter = range_iter.first;
+              return;
+            }
 
-            tmpMessage.decode(*inBuffer.get());
             boost::system::error_code callbackError;
-            if( tmpMessage.result() != net::dns::message::noerror )
+            if( tmpMessage.result() != net::dns::message::noerror || !tmpMessage.answers()->size() )
             {
-              callbackError = error::not_found;
+              // NXDOMAIN and NODATA answers are cached with the SOA from the authority section
+              if( tmpMessage.result() == net::dns::message::name_error || tmpMessage.result()
+                  == net::dns::message::noerror )
+              {
+                shared_resource_base_t soa = find_soa(*tmpMessage.authorites());
+                if( soa )
+                  _cache->add_negative(dq->_question, soa,
+                      ( tmpMessage.result() == net::dns::message::name_error ) ? negative_nxdomain : negative_nodata);
+              }
+
+              if( failed )
+                callbackError = error::host_not_found_try_again;
+              else
+                callbackError = error::not_found;
               shared_resource_base_t record;
-              ( *qiter )->_completion_callback->invoke(_ios, record, callbackError);
+              complete(dq, record, callbackError);
             }
             else
             {
@@ -410,118 +1853,80 @@ namespace boost
               if( tmpMessage.additionals()->size() )
               {
                 records = tmpMessage.additionals();
-                dns_cache_object::instance().reserve(records->size(), ( *qiter )->_question);
-                for( iter = records->begin(); iter != records->end(); iter++ )
-                  dns_cache_object::instance().add( ( *iter ));
+                _cache->reserve(records->size(), dq->_question);
+                _cache->add(*records);
               }
 
               if( tmpMessage.authorites()->size() )
               {
                 records = tmpMessage.authorites();
-                dns_cache_object::instance().reserve(records->size(), ( *qiter )->_question);
-                for( iter = records->begin(); iter != records->end(); iter++ )
-                  dns_cache_object::instance().add( ( *iter ));
+                _cache->reserve(records->size(), dq->_question);
+                _cache->add(*records);
               }
 
               if( tmpMessage.answers()->size() )
               {
                 records = tmpMessage.answers();
-                dns_cache_object::instance().reserve(records->size(), ( *qiter )->_question);
+                _cache->reserve(records->size(), dq->_question);
+                _cache->add(*records);
                 for( iter = records->begin(); iter != records->end(); iter++ )
-                {
-                  dns_cache_object::instance().add( ( *iter ));
-                  ( *qiter )->_completion_callback->invoke(_ios, ( *iter ), callbackError);
-                }
+                  complete(dq, ( *iter ), callbackError);
               }
             }
 
-            _query_list.get< by_question_id > ().erase(range_iter.first, range_iter.second);
-            if( !_query_list.size() )
-            {
-              _timer.cancel();
-              _socket.close();
-            }
+            release(qid);
           }
-          else if( ec == error::operation_aborted )
-          {
-            inBuffer.get()->length(bytes_transferred);
-
-            uint16_t qid;
-            inBuffer.get()->get(qid);
 
-            std::pair< question_id_iterator_t, question_id_iterator_t > range_iter;
-            range_iter = _query_list.get< by_question_id > ().equal_range(qid);
-
-            if( range_iter.first != range_iter.second )
-            {
-              shared_resource_base_t record;
-              ( *range_iter.first )->_completion_callback->invoke(_ios, record, error::operation_aborted);
-            }
-
-            _query_list.get< by_question_id > ().erase(range_iter.first, range_iter.second);
-            if( !_query_list.size() )
-            {
-              _timer.cancel();
-              _socket.close();
-            }
-          }
-          else
+          /*!
+           Hash of a question, the same for every case of its name
+           */
+          static std::size_t
+          question_key ( const net::dns::question& q )
           {
+            std::size_t seed(0);
+            boost::hash_combine(seed, boost::algorithm::to_lower_copy(q.domain()));
+            boost::hash_combine(seed, q.rtype());
+            boost::hash_combine(seed, q.rclass());
+            return seed;
           }
-        }
 
-        void
-        handle_timeout ( const boost::system::error_code& ec )
-        {
-          if( !ec && ec != error::operation_aborted )
+          static bool
+          same_question ( const net::dns::question& a, const net::dns::question& b )
           {
-            // Lock the list so we can manipulate it
-            boost::mutex::scoped_lock scopeLock(_resolver_mutex);
+            return a.rtype() == b.rtype() && a.rclass() == b.rclass() && boost::algorithm::iequals(a.domain(), b.domain());
+          }
 
-            if( _query_list.size() )
+          shared_resource_base_t
+          find_soa ( rr_list_t& records )
+          {
+            for( rr_list_t::iterator iter = records.begin(); iter != records.end(); ++iter )
             {
-              shared_resource_base_t record;
-
-              expired_iterator_t expired_iter = _query_list.get< by_expired > ().find(true);
-              for( ; expired_iter != _query_list.get< by_expired > ().end(); ++expired_iter )
-              {
-                if( ( *expired_iter )->expired() )
-                {
-                  ( *expired_iter )->_completion_callback->invoke(_ios, record, error::timed_out);
-                  _query_list.get< by_expired > ().erase(expired_iter);
-                }
-              }
+              if( ( *iter )->rtype() == type_soa )
+                return ( *iter );
             }
 
-            if( _query_list.size() )
-            {
-              _timer.expires_from_now(posix_time::seconds(2));
-              _timer.async_wait(boost::bind(&dns_resolver_impl::handle_timeout, this, boost::asio::placeholders::error));
+            return shared_resource_base_t();
+          }
 
-              _ios.post(bind(&dns_resolver_impl::send, this));
-            }
-            else
+          void
+          blocking_callback (
+              shared_rr_list_t& list,
+              const shared_resource_base_t& record,
+              const boost::system::error_code& ec )
+          {
+            // we're doing a asynch operation for a sync request
+            if( record )
             {
-              _socket.close();
+              list->push_back(record);
             }
+            else
+              cout << "blocking_callback: " << ec.message() << endl;
           }
-        }
+        };
 
-        void
-        blocking_callback (
-            shared_rr_list_t& list,
-            const shared_resource_base_t& record,
-            const boost::system::error_code& ec )
-        {
-          // we're doing a asynch operation for a sync request
-          if( record )
-          {
-            list->push_back(record);
-          }
-          else
-            cout << "blocking_callback: " << ec.message() << endl;
-        }
-      };
+#if !defined(GENERATING_DOCUMENTATION)
+      typedef basic_dns_resolver_impl< > dns_resolver_impl;
+#endif
 
     } // namespace dns
   } // namespace net
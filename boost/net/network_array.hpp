@@ -17,12 +17,12 @@
 // Our primary dependency is boost::asio. We can't live without it!
 #include <boost/asio/detail/push_options.hpp>
 
+#include <algorithm>
 #include <vector>
 #include <string>
 
 #include <boost/iterator.hpp>
 #include <boost/cstdint.hpp>
-#include <boost/scoped_array.hpp>
 #include <boost/asio.hpp>
 #include <boost/array.hpp>
 
@@ -58,12 +58,11 @@ namespace boost
       public:
         /// Constructs an empty network_array
         /*
-
+         The bytes are left as they are, only the first length() of them hold data.
          */
         network_array () :
-          nap(0), nal(0), _data()
+          nap(0), nal(0)
         {
-          _data.assign((uint8_t) 0x00);
         }
 
         virtual
@@ -120,6 +119,7 @@ namespace boost
         size_t
         get ( char & d, const size_t p = N + 1, const bool incpos = true )
         {
+          size_t caret(nap);
           if( p != N + 1 )
           {
             _data.rangecheck(p);
@@ -129,6 +129,8 @@ namespace boost
           d = (char) _data.elems[nap];
           if( incpos )
             nap += sizeof ( d );
+          else
+            nap = caret;
 
           return sizeof ( d );
         }
@@ -144,6 +146,7 @@ namespace boost
         size_t
         put ( const char d, const size_t p = N + 1, const bool incpos = true )
         {
+          size_t caret(nap);
           if( p != N + 1 )
           {
             _data.rangecheck(p);
@@ -157,6 +160,8 @@ namespace boost
             if( nap > nal )
               nal += sizeof ( d );
           }
+          else
+            nap = caret;
 
           return sizeof ( d );
         }
@@ -172,6 +177,7 @@ namespace boost
         size_t
         get ( uint8_t & d, const size_t p = N + 1, const bool incpos = true )
         {
+          size_t caret(nap);
           if( p != N + 1 )
           {
             _data.rangecheck(p);
@@ -182,6 +188,8 @@ namespace boost
 
           if( incpos )
             nap += sizeof ( d );
+          else
+            nap = caret;
           return sizeof ( d );
         }
 
@@ -196,6 +204,7 @@ namespace boost
         size_t
         put ( const uint8_t d, const size_t p = N + 1, const bool incpos = true )
         {
+          size_t caret(nap);
           if( p != N + 1 )
           {
             _data.rangecheck(p);
@@ -210,6 +219,8 @@ namespace boost
             if( nap > nal )
               nal += sizeof ( d );
           }
+          else
+            nap = caret;
 
           return sizeof ( d );
         }
@@ -225,6 +236,7 @@ namespace boost
         size_t
         get ( uint16_t & d, const size_t p = N + 1, const bool incpos = true )
         {
+          size_t caret(nap);
           if( p != N + 1 )
           {
             _data.rangecheck(p);
@@ -235,6 +247,8 @@ namespace boost
 
           if( incpos )
             nap += sizeof ( d );
+          else
+            nap = caret;
           return sizeof ( d );
         }
 
@@ -249,6 +263,7 @@ namespace boost
         size_t
         put ( const uint16_t d, const size_t p = N + 1, const bool incpos = true )
         {
+          size_t caret(nap);
           if( p != N + 1 )
           {
             _data.rangecheck(p);
@@ -263,6 +278,8 @@ namespace boost
             if( nap > nal )
               nal += sizeof ( d );
           }
+          else
+            nap = caret;
 
           return sizeof ( d );
         }
@@ -278,6 +295,7 @@ namespace boost
         size_t
         get ( uint32_t & d, const size_t p = N + 1, const bool incpos = true )
         {
+          size_t caret(nap);
           if( p != N + 1 )
           {
             _data.rangecheck(p);
@@ -288,6 +306,8 @@ namespace boost
 
           if( incpos )
             nap += sizeof ( d );
+          else
+            nap = caret;
           return sizeof ( d );
         }
 
@@ -302,6 +322,7 @@ namespace boost
         size_t
         put ( const uint32_t d, const size_t p = N + 1, const bool incpos = true )
         {
+          size_t caret(nap);
           if( p != N + 1 )
           {
             _data.rangecheck(p);
@@ -316,6 +337,8 @@ namespace boost
             if( nap > nal )
               nal += sizeof ( d );
           }
+          else
+            nap = caret;
 
           return sizeof ( d );
         }
@@ -331,6 +354,7 @@ namespace boost
         size_t
         get ( ip::address_v4 & d, const size_t p = N + 1, const bool incpos = true )
         {
+          size_t caret(nap);
           if( p != N + 1 )
           {
             _data.rangecheck(p);
@@ -341,6 +365,8 @@ namespace boost
 
           if( incpos )
             nap += sizeof(uint32_t);
+          else
+            nap = caret;
           return sizeof ( d );
         }
 
@@ -355,6 +381,7 @@ namespace boost
         size_t
         put ( const ip::address_v4 & d, const size_t p = N + 1, const bool incpos = true )
         {
+          size_t caret(nap);
           if( p != N + 1 )
           {
             _data.rangecheck(p);
@@ -369,6 +396,8 @@ namespace boost
             if( nap > nal )
               nal += sizeof(uint32_t);
           }
+          else
+            nap = caret;
 
           return sizeof ( d );
         }
@@ -384,6 +413,7 @@ namespace boost
         size_t
         get ( ip::address_v6 & d, const size_t p = N + 1, const bool incpos = true )
         {
+          size_t caret(nap);
           if( p != N + 1 )
           {
             _data.rangecheck(p);
@@ -399,6 +429,8 @@ namespace boost
             if( nap > nal )
               nal += 16;
           }
+          else
+            nap = caret;
           return 16;
         }
 
@@ -413,6 +445,7 @@ namespace boost
         size_t
         put ( const ip::address_v6 & d, const size_t p = N + 1, const bool incpos = true )
         {
+          size_t caret(nap);
           if( p != N + 1 )
           {
             _data.rangecheck(p);
@@ -427,6 +460,8 @@ namespace boost
             if( nap > nal )
               nal += sizeof(uint32_t);
           }
+          else
+            nap = caret;
 
           return sizeof ( d );
         }
@@ -443,16 +478,16 @@ namespace boost
         size_t
         get ( string & d, const size_t len, const size_t p = N + 1, const bool incpos = true )
         {
+          size_t caret(nap);
           if( p != N + 1 )
           {
             _data.rangecheck(p);
             position(p);
           }
 
-          scoped_array< char > cPtr(new char[len + 1]);
-          strncpy(cPtr.get(), (char*) &_data.elems[nap], len);
-          cPtr.get()[len] = 0x00;
-          d = cPtr.get();
+          // stops at a NUL like strncpy would, without a temporary copy
+          const char* src((const char*) &_data.elems[nap]);
+          d.assign(src, std::find(src, src + len, '\0'));
 
           if( incpos )
           {
@@ -460,6 +495,8 @@ namespace boost
             if( nap > nal )
               nal += len;
           }
+          else
+            nap = caret;
 
           return len;
         }
@@ -476,6 +513,7 @@ namespace boost
         size_t
         put ( const string & d, const size_t len, const size_t p = N + 1, const bool incpos = true )
         {
+          size_t caret(nap);
           if( p != N + 1 )
           {
             _data.rangecheck(p);
@@ -492,6 +530,8 @@ namespace boost
             if( nap > nal )
               nal += len;
           }
+          else
+            nap = caret;
 
           return len;
         }
@@ -509,7 +549,8 @@ namespace boost
 
       };
 
-    typedef network_array< 576 > dns_buffer_t;
+    /// Room for the largest DNS message, what a TCP length prefix can announce
+    typedef network_array< 65535 > dns_buffer_t;
     typedef shared_ptr< dns_buffer_t > shared_dns_buffer_t;
 
   } // namespace net
@@ -207,7 +207,7 @@ namespace boost
 
           // send out the packets for request
           for( vector< ip::udp::endpoint >::iterator iter = endpointList.begin(); iter != endpointList.end(); ++iter )
-            socket.send_to(boost::asio::buffer(reqBuffer.get_array()), *iter);
+            socket.send_to(boost::asio::buffer(reqBuffer.get_array().data(), reqBuffer.length()), *iter);
         }
 
         void
@@ -216,7 +216,7 @@ namespace boost
           if( !ec || ec == boost::asio::error::message_size )
           {
             // only decode if we haven't decoded already!
-            if( responseMessage.result() != dns::message::no_result )
+            if( responseMessage.result() == dns::message::no_result )
             {
               boost::mutex::scoped_lock lock(bufferMutex);
 
@@ -33,7 +33,7 @@ namespace boost
   namespace net
   {
 
-    typedef network_array< 576 > dns_buffer_t;
+    typedef network_array< 65535 > dns_buffer_t;
 
     /*!
      The rfc1035_414_t class is a helper class for dealing with DNS label compression inside
@@ -208,7 +208,15 @@ namespace boost
             string s;
             buffer.get(s, len);
 
-            domain += to_lower_copy(s) + ".";
+            // plain ASCII folding (RFC 4343), to_lower_copy goes through the locale per character
+            for( string::iterator iter = s.begin(); iter != s.end(); ++iter )
+            {
+              if( *iter >= 'A' && *iter <= 'Z' )
+                *iter += 'a' - 'A';
+            }
+
+            domain += s;
+            domain += '.';
           }
           else
             break;
@@ -0,0 +1,160 @@
+// cache_bench.cpp : Replays a query trace against the dns cache eviction policies
+//
+// Usage: cache_bench [capacity] [trace file]
+//
+// The trace file has one query name per line. Without a trace, a Zipf
+// distributed trace with periodic bursts of one-off names is generated.
+//
+// A second run replays a pollution attack: the caches are warmed with the
+// trace, then every legitimate query is followed by four one-off names. The
+// hit ratio of the legitimate queries shows how much of the working set each
+// cache keeps, with and without the admission doorkeeper.
+//
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <cmath>
+#include <cstdlib>
+
+#include <boost/net/dns.hpp>
+#include <boost/net/dns_debug.hpp>
+#include <boost/net/dns_cache.hpp>
+#include <boost/random.hpp>
+#include <boost/lexical_cast.hpp>
+
+using namespace std;
+using namespace boost;
+using namespace boost::net;
+
+void make_trace(vector<string>& trace, size_t names, size_t length)
+{
+  boost::mt19937 rng(42);
+  boost::uniform_real<> unit(0.0, 1.0);
+
+  // zipf, s = 0.9
+  vector<double> cdf(names);
+  double total(0.0);
+  for( size_t i = 0; i < names; ++i )
+  {
+    total += 1.0 / pow(double(i + 1), 0.9);
+    cdf[i] = total;
+  }
+
+  size_t oneOff(0);
+  for( size_t i = 0; i < length; ++i )
+  {
+    // every 10th block of 1000 queries is scanner traffic
+    if( ( i / 1000 ) % 10 == 9 )
+    {
+      trace.push_back("probe" + lexical_cast<string>(oneOff++) + ".example.com.");
+      continue;
+    }
+
+    double r = unit(rng) * total;
+    size_t rank = lower_bound(cdf.begin(), cdf.end(), r) - cdf.begin();
+    trace.push_back("host" + lexical_cast<string>(rank) + ".example.com.");
+  }
+}
+
+void make_attack(vector<string>& attack, const vector<string>& trace, size_t junk)
+{
+  size_t oneOff(0);
+  for( vector<string>::const_iterator iter = trace.begin(); iter != trace.end(); ++iter )
+  {
+    attack.push_back(*iter);
+    for( size_t i = 0; i < junk; ++i )
+      attack.push_back("junk" + lexical_cast<string>(oneOff++) + ".attack.com.");
+  }
+}
+
+// hit ratio over the names that don't start with skip
+template<typename Cache>
+double replay(Cache& cache, const vector<string>& trace, const string& skip = string())
+{
+  size_t hits(0);
+  size_t queries(0);
+  for( vector<string>::const_iterator iter = trace.begin(); iter != trace.end(); ++iter )
+  {
+    bool counted = skip.empty() || iter->compare(0, skip.size(), skip) != 0;
+    if( counted )
+      ++queries;
+
+    dns::question q(*iter, dns::type_a);
+    if( !cache.get(q).empty() )
+    {
+      if( counted )
+        ++hits;
+      continue;
+    }
+
+    dns::a_resource* rr = new dns::a_resource(*iter);
+    rr->ttl(86400);
+    cache.add(dns::shared_resource_base_t(rr));
+  }
+
+  return queries ? double(hits) / double(queries) : 0.0;
+}
+
+template<typename Cache>
+void attack(const char* name, Cache& cache, const vector<string>& trace, const vector<string>& attack)
+{
+  replay(cache, trace);
+  double warm = replay(cache, trace);
+  double polluted = replay(cache, attack, "junk");
+  cout << name << " hit ratio: " << warm << " -> " << polluted << " under attack, "
+      << cache.stats().rejected << " RRsets turned away" << endl;
+}
+
+int main(int argc, char* argv[])
+{
+  uint32_t capacity = ( argc > 1 ) ? atoi(argv[1]) : 1000;
+
+  vector<string> trace;
+  if( argc > 2 )
+  {
+    ifstream in(argv[2]);
+    string name;
+    while( in >> name )
+      trace.push_back(name);
+  }
+  else
+    make_trace(trace, 100000, 1000000);
+
+  cout << "capacity: " << capacity << ", queries: " << trace.size() << endl;
+
+  dns::basic_dns_cache<dns::lru_policy> lru(capacity);
+  cout << "LRU       hit ratio: " << replay(lru, trace) << endl;
+
+  dns::basic_dns_cache<dns::clock_policy> clock(capacity);
+  cout << "CLOCK     hit ratio: " << replay(clock, trace) << endl;
+
+  dns::basic_dns_cache<dns::tinylfu_policy> tinylfu(capacity);
+  cout << "W-TinyLFU hit ratio: " << replay(tinylfu, trace) << endl;
+
+  // pollution attack on a shorter slice of the trace
+  vector<string> slice(trace.begin(), trace.begin() + ( min )(trace.size(), size_t(200000)));
+  vector<string> junk;
+  make_attack(junk, slice, 4);
+
+  cout << endl << "pollution attack, 4 one-off names per query:" << endl;
+
+  dns::basic_dns_cache<dns::lru_policy> lruAttack(capacity);
+  attack("LRU              ", lruAttack, slice, junk);
+
+  dns::basic_dns_cache<dns::lru_policy> lruAdmit(capacity);
+  lruAdmit.admission(true);
+  attack("LRU + doorkeeper ", lruAdmit, slice, junk);
+
+  dns::basic_dns_cache<dns::clock_policy> clockAttack(capacity);
+  attack("CLOCK            ", clockAttack, slice, junk);
+
+  dns::basic_dns_cache<dns::clock_policy> clockAdmit(capacity);
+  clockAdmit.admission(true);
+  attack("CLOCK + doorkeeper", clockAdmit, slice, junk);
+
+  dns::basic_dns_cache<dns::tinylfu_policy> tinylfuAttack(capacity);
+  attack("W-TinyLFU        ", tinylfuAttack, slice, junk);
+
+  return 0;
+}